@@ -0,0 +1,215 @@
+#include "binarize.h"
+
+#include <string.h>
+#include <stdint.h>
+
+// vector types
+typedef uint8_t u8x16 __attribute__((vector_size(16)));
+typedef uint8_t u8x4 __attribute__((vector_size(4)));
+typedef int8_t i8x4 __attribute__((vector_size(4)));
+typedef int32_t i32x4 __attribute__((vector_size(16)));
+typedef float f32x4 __attribute__((vector_size(16)));
+
+// global threshold by Otsu's method: pixels at or below the threshold are black
+static
+unsigned otsu_threshold(const image* const img)
+{
+	const size_t n = (size_t)img->width * img->height;
+
+	// histogram
+	size_t hist[256] = {0};
+
+	for(size_t i = 0; i < n; ++i)
+		++hist[img->pixels[i]];
+
+	double sum = 0;
+
+	for(unsigned i = 0; i < 256; ++i)
+		sum += (double)i * hist[i];
+
+	// maximise the between-class variance
+	double sum_b = 0, best = -1;
+	size_t w_b = 0;
+	unsigned threshold = 0;
+
+	for(unsigned t = 0; t < 256; ++t)
+	{
+		if((w_b += hist[t]) == 0)
+			continue;
+
+		const size_t w_f = n - w_b;
+
+		if(w_f == 0)
+			break;
+
+		sum_b += (double)t * hist[t];
+
+		const double m_b = sum_b / w_b, m_f = (sum - sum_b) / w_f;
+		const double v = (double)w_b * w_f * (m_b - m_f) * (m_b - m_f);
+
+		if(v > best)
+		{
+			best = v;
+			threshold = t;
+		}
+	}
+
+	return threshold;
+}
+
+unsigned binarize_otsu(image* const img)
+{
+	const unsigned char t = otsu_threshold(img);
+	const u8x16 tv = (u8x16){0} + t, white = (u8x16){0} + (unsigned char)img->maxval;
+
+	unsigned char* p = img->pixels;
+	size_t n = (size_t)img->width * img->height;
+
+	for(; n >= sizeof(u8x16); n -= sizeof(u8x16), p += sizeof(u8x16))
+	{
+		u8x16 v;
+
+		memcpy(&v, p, sizeof(v));
+
+		v = ~(u8x16)(v <= tv) & white;
+
+		memcpy(p, &v, sizeof(v));
+	}
+
+	for(; n > 0; --n, ++p)
+		*p = (*p <= t) ? 0 : img->maxval;
+
+	img->bilevel = true;
+
+	return t;
+}
+
+// Sauvola's threshold is T = m * (1 + k * (s / R - 1)), where m and s are the local mean
+// and standard deviation, and R is half the dynamic range. A pixel p is black when p <= T,
+// which is tested without the square root as (p - m * (1 - k)) <= (m * k / R) * s.
+static
+void threshold_row(const unsigned char* const src, unsigned char* const dest,
+				   const float* const mean, const float* const var, const unsigned width,
+				   const float k1, const float k2, const unsigned char white)
+{
+	const u8x4 wv = (u8x4){0} + white;
+	unsigned x = 0;
+
+	for(; x + 4 <= width; x += 4)
+	{
+		u8x4 pv;
+		f32x4 m, v;
+
+		memcpy(&pv, src + x, sizeof(pv));
+		memcpy(&m, mean + x, sizeof(m));
+		memcpy(&v, var + x, sizeof(v));
+
+		const f32x4 p = __builtin_convertvector(pv, f32x4);
+		const f32x4 a = p - m * k1, b = m * k2;
+		const i32x4 black = (a <= 0) | (a * a <= b * b * v);
+		const u8x4 res = ~(u8x4)__builtin_convertvector(black, i8x4) & wv;
+
+		memcpy(dest + x, &res, sizeof(res));
+	}
+
+	for(; x < width; ++x)
+	{
+		const float a = src[x] - mean[x] * k1, b = mean[x] * k2;
+
+		dest[x] = (a <= 0 || a * a <= b * b * var[x]) ? 0 : white;
+	}
+}
+
+void binarize_sauvola(image* const img, const unsigned window, const double k)
+{
+	const unsigned w = img->width, h = img->height, r = window / 2;
+	const float k1 = 1 - k, k2 = k / ((img->maxval + 1) / 2.0);
+
+	// window sums per column, and their prefix sums along the row (one row of the
+	// integral images of pixel values and of their squares)
+	uint32_t* const col_sum = mem_alloc(w * sizeof(uint32_t));
+	uint32_t* const col_sq = mem_alloc(w * sizeof(uint32_t));
+	uint64_t* const row_sum = mem_alloc((w + 1) * sizeof(uint64_t));
+	uint64_t* const row_sq = mem_alloc((w + 1) * sizeof(uint64_t));
+	float* const mean = mem_alloc(w * sizeof(float));
+	float* const var = mem_alloc(w * sizeof(float));
+	unsigned char* const dest = mem_alloc((size_t)w * h);
+
+	memset(col_sum, 0, w * sizeof(uint32_t));
+	memset(col_sq, 0, w * sizeof(uint32_t));
+
+	// rows [0, r) are in the window before the first row
+	for(unsigned y = 0; y < min(r, h); ++y)
+	{
+		const unsigned char* const row = img->pixels + (size_t)y * w;
+
+		for(unsigned x = 0; x < w; ++x)
+		{
+			col_sum[x] += row[x];
+			col_sq[x] += row[x] * row[x];
+		}
+	}
+
+	row_sum[0] = row_sq[0] = 0;
+
+	for(unsigned y = 0; y < h; ++y)
+	{
+		// slide the window down
+		if(y + r < h)
+		{
+			const unsigned char* const row = img->pixels + (size_t)(y + r) * w;
+
+			for(unsigned x = 0; x < w; ++x)
+			{
+				col_sum[x] += row[x];
+				col_sq[x] += row[x] * row[x];
+			}
+		}
+
+		if(y > r)
+		{
+			const unsigned char* const row = img->pixels + (size_t)(y - r - 1) * w;
+
+			for(unsigned x = 0; x < w; ++x)
+			{
+				col_sum[x] -= row[x];
+				col_sq[x] -= row[x] * row[x];
+			}
+		}
+
+		const unsigned rows = min(y + r + 1, h) - (y > r ? y - r : 0);
+
+		// prefix sums
+		for(unsigned x = 0; x < w; ++x)
+		{
+			row_sum[x + 1] = row_sum[x] + col_sum[x];
+			row_sq[x + 1] = row_sq[x] + col_sq[x];
+		}
+
+		// local statistics
+		for(unsigned x = 0; x < w; ++x)
+		{
+			const unsigned x0 = (x > r) ? x - r : 0, x1 = min(x + r + 1, w);
+			const double n = (double)(x1 - x0) * rows;
+			const double m = (row_sum[x1] - row_sum[x0]) / n;
+
+			mean[x] = m;
+			var[x] = (row_sq[x1] - row_sq[x0]) / n - m * m;
+		}
+
+		const size_t offset = (size_t)y * w;
+
+		threshold_row(img->pixels + offset, dest + offset, mean, var, w, k1, k2, img->maxval);
+	}
+
+	mem_free(img->pixels);
+	img->pixels = dest;
+	img->bilevel = true;
+
+	mem_free(col_sum);
+	mem_free(col_sq);
+	mem_free(row_sum);
+	mem_free(row_sq);
+	mem_free(mean);
+	mem_free(var);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "image.h"
+
+// binarise the image using global Otsu's threshold, at or below which pixels are black;
+// returns the threshold
+unsigned binarize_otsu(image* const img);
+
+// binarise the image using Sauvola's local threshold over the window of the given size
+// (odd number of pixels), with sensitivity k (typically from 0.2 to 0.5)
+void binarize_sauvola(image* const img, const unsigned window, const double k);
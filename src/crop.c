@@ -0,0 +1,84 @@
+#include "crop.h"
+
+#include <string.h>
+
+void image_crop(image* const img, const unsigned x, const unsigned y, const unsigned width, const unsigned height)
+{
+	// rows move towards the start of the buffer, so they can be moved in place
+	const unsigned char* src = img->pixels + (size_t)y * img->width + x;
+	unsigned char* dest = img->pixels;
+
+	for(unsigned i = 0; i < height; ++i, src += img->width, dest += width)
+		memmove(dest, src, width);
+
+	img->width = width;
+	img->height = height;
+}
+
+// check if the row segment has any content
+static inline
+bool has_ink(const unsigned char* const p, const size_t n, const size_t stride, const unsigned char level)
+{
+	for(size_t i = 0; i < n; ++i)
+		if(p[i * stride] < level)
+			return true;
+
+	return false;
+}
+
+bool content_box(const image* const img, const double fuzz,
+				 unsigned* const x, unsigned* const y, unsigned* const width, unsigned* const height)
+{
+	const unsigned w = img->width, h = img->height;
+	const unsigned char level = img->maxval - (unsigned char)(fuzz * img->maxval + 0.5);
+	const unsigned char* const p = img->pixels;
+
+	// top and bottom rows
+	unsigned top = 0, bottom = h;
+
+	while(top < h && !has_ink(p + (size_t)top * w, w, 1, level))
+		++top;
+
+	if(top == h)
+		return false;
+
+	while(!has_ink(p + (size_t)(bottom - 1) * w, w, 1, level))
+		--bottom;
+
+	// left and right columns, within the rows found
+	const unsigned char* const first = p + (size_t)top * w;
+	const size_t rows = bottom - top;
+	unsigned left = 0, right = w;
+
+	while(!has_ink(first + left, rows, w, level))
+		++left;
+
+	while(!has_ink(first + right - 1, rows, w, level))
+		--right;
+
+	*x = left;
+	*y = top;
+	*width = right - left;
+	*height = bottom - top;
+
+	return true;
+}
+
+void image_border(image* const img, const unsigned bx, const unsigned by)
+{
+	image res;
+
+	image_init(&res, img->width + 2 * bx, img->height + 2 * by, img->maxval);
+
+	res.bilevel = img->bilevel;
+
+	const unsigned char* src = img->pixels;
+	unsigned char* dest = res.pixels + (size_t)by * res.width + bx;
+
+	for(unsigned i = 0; i < img->height; ++i, src += img->width, dest += res.width)
+		memcpy(dest, src, img->width);
+
+	image_free(img);
+
+	*img = res;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "image.h"
+
+// cut the given rectangle out of the image; the rectangle must lie within the image
+void image_crop(image* const img, const unsigned x, const unsigned y, const unsigned width, const unsigned height);
+
+// bounding box of the content of the image, that is, of the pixels darker than white
+// by more than the given fraction of the maximum value; returns false if the image has
+// no content
+bool content_box(const image* const img, const double fuzz,
+				 unsigned* const x, unsigned* const y, unsigned* const width, unsigned* const height);
+
+// surround the image with a white border of the given thickness
+void image_border(image* const img, const unsigned bx, const unsigned by);
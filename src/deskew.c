@@ -0,0 +1,227 @@
+#include "deskew.h"
+
+#include <string.h>
+#include <math.h>
+
+// the angle is estimated on a downsampled image of about this size
+#define SAMPLE_SIZE 1024
+
+// minimal number of ink points for the estimation to be meaningful
+#define MIN_INK_POINTS 100
+
+// ink point on the downsampled image, with x relative to the centre
+typedef struct
+{
+	int x, y;
+} point;
+
+// collect ink points: a point is set when any pixel in the block is dark
+static
+point* ink_points(const image* const img, const unsigned f, size_t* const pnum, unsigned* const pheight)
+{
+	const unsigned dw = img->width / f, dh = img->height / f;
+	const unsigned char level = (img->maxval + 1) / 2;
+
+	unsigned char* const row_min = mem_alloc(img->width);
+	point* points = NULL;
+	size_t num = 0, cap = 0;
+
+	for(unsigned y = 0; y < dh; ++y)
+	{
+		// column-wise minimum over the rows of the block
+		const unsigned char* src = img->pixels + (size_t)y * f * img->width;
+
+		memcpy(row_min, src, img->width);
+
+		for(unsigned i = 1; i < f; ++i)
+		{
+			src += img->width;
+
+			for(unsigned x = 0; x < img->width; ++x)
+				row_min[x] = min(row_min[x], src[x]);
+		}
+
+		// blocks
+		for(unsigned x = 0; x < dw; ++x)
+		{
+			const unsigned char* const p = row_min + x * f;
+			unsigned char m = p[0];
+
+			for(unsigned i = 1; i < f; ++i)
+				m = min(m, p[i]);
+
+			if(m < level)
+			{
+				if(num == cap)
+				{
+					cap = cap ? 2 * cap : 4096;
+					points = mem_realloc(points, cap * sizeof(point));
+				}
+
+				points[num++] = (point){ (int)x - (int)(dw / 2), y };
+			}
+		}
+	}
+
+	mem_free(row_min);
+
+	*pnum = num;
+	*pheight = dh;
+	return points;
+}
+
+// projection profile score: sum of squared differences between adjacent bins;
+// it reaches its maximum when the bins are aligned with the text lines
+static
+double profile_score(const point* const points, const size_t num, const double angle,
+					 unsigned* const bins, const unsigned num_bins, const int offset)
+{
+	const double t = tan(angle * M_PI / 180);
+
+	memset(bins, 0, num_bins * sizeof(unsigned));
+
+	for(size_t i = 0; i < num; ++i)
+		++bins[lround(points[i].y - points[i].x * t) + offset];
+
+	double score = 0;
+
+	for(unsigned i = 1; i < num_bins; ++i)
+	{
+		const double d = (double)bins[i] - bins[i - 1];
+
+		score += d * d;
+	}
+
+	return score;
+}
+
+static
+double best_angle(const point* const points, const size_t num,
+				  unsigned* const bins, const unsigned num_bins, const int offset,
+				  const double from, const double to, const double step)
+{
+	double best = 0, best_score = -1;
+
+	for(double a = from; a <= to + step / 2; a += step)
+	{
+		const double score = profile_score(points, num, a, bins, num_bins, offset);
+
+		if(score > best_score)
+		{
+			best = a;
+			best_score = score;
+		}
+	}
+
+	return best;
+}
+
+double skew_angle(const image* const img, const double max_angle)
+{
+	const unsigned f = max(1u, max(img->width, img->height) / SAMPLE_SIZE);
+
+	size_t num;
+	unsigned height;
+	point* const points = ink_points(img, f, &num, &height);
+
+	if(num < MIN_INK_POINTS)
+	{
+		mem_free(points);
+		return 0;
+	}
+
+	// bins must accommodate the points shifted by up to half the width times the slope
+	const int offset = (int)ceil(img->width / f / 2 * tan(max_angle * M_PI / 180)) + 1;
+	const unsigned num_bins = height + 2 * offset + 1;
+	unsigned* const bins = mem_alloc(num_bins * sizeof(unsigned));
+
+	// coarse search, then refinement around the best angle
+	double angle = best_angle(points, num, bins, num_bins, offset, -max_angle, max_angle, 0.1);
+
+	angle = best_angle(points, num, bins, num_bins, offset,
+					   max(angle - 0.1, -max_angle), min(angle + 0.1, max_angle), 0.01);
+
+	mem_free(bins);
+	mem_free(points);
+
+	return angle;
+}
+
+// rotation by three shears (A. Paeth, "A Fast Algorithm for General Raster Rotation"):
+// each horizontal shear moves whole rows, and each vertical shear moves runs of columns
+// with the same offset, so that all pixel transfers are done by memmove(3) or memcpy(3)
+
+static
+void shear_rows(image* const img, const double a)
+{
+	const unsigned w = img->width;
+	const double cy = img->height / 2.0;
+
+	unsigned char* row = img->pixels;
+
+	for(unsigned y = 0; y < img->height; ++y, row += w)
+	{
+		const long s = lround(a * (y - cy));
+
+		if(s == 0)
+			continue;
+
+		if((unsigned long)labs(s) >= w)
+			memset(row, img->maxval, w);
+		else if(s > 0)
+		{
+			memmove(row + s, row, w - s);
+			memset(row, img->maxval, s);
+		}
+		else
+		{
+			memmove(row, row - s, w + s);
+			memset(row + w + s, img->maxval, -s);
+		}
+	}
+}
+
+static
+void shear_columns(image* const img, const double b, unsigned char* const dest)
+{
+	const unsigned w = img->width, h = img->height;
+	const double cx = w / 2.0;
+
+	memset(dest, img->maxval, (size_t)w * h);
+
+	for(unsigned x0 = 0; x0 < w; )
+	{
+		// run of columns with the same offset
+		const long s = lround(b * (x0 - cx));
+		unsigned x1 = x0 + 1;
+
+		while(x1 < w && lround(b * (x1 - cx)) == s)
+			++x1;
+
+		// copy the run from each source row to its destination row
+		const size_t n = x1 - x0;
+		const long y_from = max(0L, s), y_to = min((long)h, (long)h + s);
+
+		for(long y = y_from; y < y_to; ++y)
+			memcpy(dest + y * w + x0, img->pixels + (y - s) * w + x0, n);
+
+		x0 = x1;
+	}
+}
+
+void image_rotate(image* const img, const double angle)
+{
+	const double r = angle * M_PI / 180, a = -tan(r / 2), b = sin(r);
+
+	unsigned char* const tmp = mem_alloc((size_t)img->width * img->height);
+
+	shear_rows(img, a);
+	shear_columns(img, b, tmp);
+
+	unsigned char* const src = img->pixels;
+
+	img->pixels = tmp;
+	mem_free(src);
+
+	shear_rows(img, a);
+}
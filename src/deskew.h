@@ -0,0 +1,10 @@
+#pragma once
+
+#include "image.h"
+
+// estimate the skew angle of the text lines in degrees, within [-max_angle, max_angle];
+// positive angle means the lines descend to the right
+double skew_angle(const image* const img, const double max_angle);
+
+// rotate the image clockwise by the given (small) angle in degrees, keeping its size
+void image_rotate(image* const img, const double angle);
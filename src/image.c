@@ -0,0 +1,133 @@
+#include "image.h"
+#include "pgm.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+void image_init(image* const img, const unsigned width, const unsigned height, const unsigned maxval)
+{
+	const size_t size = (size_t)width * height;
+
+	*img = (image){ width, height, maxval, mem_alloc(size), false };
+
+	memset(img->pixels, maxval, size);
+}
+
+// PBM to 8-bit grayscale
+static
+void unpack_bits(image* const img, const pgm_image* const src)
+{
+	image_init(img, src->width, src->height, 255);
+
+	img->bilevel = true;
+
+	const size_t stride = pgm_row_size(src);
+	const unsigned char* row = src->pixels;
+	unsigned char* p = img->pixels;
+
+	for(unsigned y = 0; y < img->height; ++y, row += stride)
+		for(unsigned x = 0; x < img->width; ++x)
+			*p++ = ((row[x / 8] >> (7 - x % 8)) & 1) ? 0 : 255;
+}
+
+// 8-bit grayscale to PBM
+static
+bool write_bits(const image* const img, FILE* const stream)
+{
+	const size_t stride = (img->width + 7) / 8;
+	const unsigned char level = (img->maxval + 1) / 2;
+	unsigned char* const row = mem_alloc(stride);
+	const unsigned char* p = img->pixels;
+	bool ok = true;
+
+	for(unsigned y = 0; ok && y < img->height; ++y)
+	{
+		memset(row, 0, stride);
+
+		for(unsigned x = 0; x < img->width; ++x)
+			if(*p++ < level)
+				row[x / 8] |= 0x80 >> (x % 8);
+
+		ok = (fwrite(row, 1, stride, stream) == stride);
+	}
+
+	mem_free(row);
+	return ok;
+}
+
+void image_load(image* const img, const char* const name)
+{
+	pgm_image src;
+
+	pgm_map(&src, name);
+
+	if(src.maxval > 255)
+		die(0, "16-bit images are not supported: \"%s\"", name);
+
+	if(src.packed)
+		unpack_bits(img, &src);
+	else
+	{
+		const size_t size = pgm_raster_size(&src);
+
+		*img = (image){ src.width, src.height, src.maxval, mem_alloc(size), false };
+
+		memcpy(img->pixels, src.pixels, size);
+	}
+
+	pgm_unmap(&src);
+}
+
+void image_save(const image* const img, const char* const name)
+{
+	// temporary file in the same directory
+	char* tmp = NULL;
+
+	just(asprintf(&tmp, "%s.XXXXXX", name));
+
+	const int fd = mkostemp(tmp, O_CLOEXEC);
+
+	if(fd < 0)
+		die(errno, "cannot create temporary file for \"%s\"", name);
+
+	FILE* const stream = fdopen(fd, "w");
+
+	if(!stream)
+		die(errno, "cannot create temporary file for \"%s\"", name);
+
+	const size_t size = (size_t)img->width * img->height;
+
+	const bool ok = img->bilevel
+		? (fprintf(stream, "P4\n%u %u\n", img->width, img->height) >= 0 && write_bits(img, stream))
+		: (fprintf(stream, "P5\n%u %u\n%u\n", img->width, img->height, img->maxval) >= 0
+		   && fwrite(img->pixels, 1, size, stream) == size);
+
+	if(!ok
+	   || fchmod(fd, 0644) < 0
+	   || fclose(stream) != 0)
+	{
+		const int err = errno;
+
+		unlink(tmp);
+		die(err, "error writing file \"%s\"", tmp);
+	}
+
+	if(rename(tmp, name) < 0)
+	{
+		const int err = errno;
+
+		unlink(tmp);
+		die(err, "cannot replace file \"%s\"", name);
+	}
+
+	free(tmp);
+}
+
+void image_free(image* const img)
+{
+	mem_free(img->pixels);
+
+	*img = (image){0};
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "utils.h"
+
+// in-memory grayscale image, one byte per pixel
+typedef struct
+{
+	unsigned width, height, maxval;
+	unsigned char* pixels;
+	bool bilevel;	// pixels are either 0 or maxval, and the image is saved in PBM format
+} image;
+
+// allocate image of the given size, filled with white
+void image_init(image* const img, const unsigned width, const unsigned height, const unsigned maxval);
+
+// load image from the given PGM or PBM file
+void image_load(image* const img, const char* const name);
+
+// save image to the given file in PGM format, or in PBM format if the image is bilevel,
+// replacing the file atomically
+void image_save(const image* const img, const char* const name);
+
+// release the image memory
+void image_free(image* const img);
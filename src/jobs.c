@@ -0,0 +1,137 @@
+#include "jobs.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#define MAX_WORKERS 1024
+
+static
+void start_job(const job_runner* const runner, pid_t* const pid, const size_t job, const unsigned worker)
+{
+	if(runner->start)
+		runner->start(runner->ctx, job);
+
+	// flush all output streams before fork
+	just(fflush(NULL));
+
+	if((*pid = just(fork())) == 0)
+	{
+		// child process
+		const int ret = runner->run(runner->ctx, job, worker);
+
+		just(fflush(NULL));
+		_exit(ret);
+	}
+}
+
+// next job to start, skipping the jobs not claimed
+static
+size_t next_claimed(const job_runner* const runner, size_t next, const size_t num_jobs)
+{
+	if(runner->claim)
+		while(next < num_jobs && !runner->claim(runner->ctx, next))
+			++next;
+
+	return next;
+}
+
+int run_jobs(const job_runner* const runner, const size_t num_jobs, const unsigned num_workers)
+{
+	const unsigned n = (unsigned)min((size_t)num_workers, num_jobs);
+
+	if(n == 0)
+		return 0;
+
+	// worker slots
+	pid_t* const pids = mem_alloc(n * sizeof(pid_t));
+	size_t* const jobs = mem_alloc(n * sizeof(size_t));
+
+	memset(pids, 0, n * sizeof(pid_t));
+
+	size_t next = 0;
+	unsigned running = 0;
+	int result = 0;
+
+	for(unsigned i = 0; i < n; ++i)
+	{
+		if((next = next_claimed(runner, next, num_jobs)) == num_jobs
+			|| (i > 0 && runner->admit && !runner->admit(runner->ctx, next)))
+			break;
+
+		start_job(runner, &pids[i], next, i);
+		jobs[i] = next++;
+		++running;
+	}
+
+	while(running > 0)
+	{
+		int status;
+		const pid_t pid = just(waitpid(-1, &status, 0));
+
+		// find the slot
+		unsigned i = 0;
+
+		while(i < n && pids[i] != pid)
+			++i;
+
+		if(i == n)
+			continue;	// not our child
+
+		pids[i] = 0;
+		--running;
+
+		runner->done(runner->ctx, jobs[i], status);
+
+		if(result == 0 && !(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+			result = status;
+
+		// next jobs, as many as admitted into the free slots
+		for(i = 0; i < n && (result == 0 || runner->keep_going) && next < num_jobs; ++i)
+		{
+			if(pids[i] != 0)
+				continue;
+
+			if((next = next_claimed(runner, next, num_jobs)) == num_jobs)
+				break;
+
+			if(running > 0 && runner->admit && !runner->admit(runner->ctx, next))
+				break;
+
+			start_job(runner, &pids[i], next, i);
+			jobs[i] = next++;
+			++running;
+		}
+	}
+
+	mem_free(pids);
+	mem_free(jobs);
+
+	return result;
+}
+
+void* shared_alloc(const size_t size)
+{
+	void* const p = mmap(NULL, max(size, (size_t)1), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if(p == MAP_FAILED)
+		die(errno, "internal error (mmap)");
+
+	return p;
+}
+
+unsigned parse_num_jobs(const char* const arg)
+{
+	unsigned n = 0;
+	const char* s = arg;
+
+	for(; *s >= '0' && *s <= '9' && n <= MAX_WORKERS; ++s)
+		n = n * 10 + *s - '0';
+
+	if(s == arg || *s != 0 || n == 0 || n > MAX_WORKERS)
+		die(0, "invalid number of jobs: \"%s\" (expected a number from 1 to %u)", arg, MAX_WORKERS);
+
+	return n;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "utils.h"
+
+// parallel job runner: each job is executed in a separate child process
+typedef struct
+{
+	// called in the parent process just before the job is started (optional)
+	void (*start)(void* const ctx, const size_t job);
+
+	// job body, called in the child process; returns the exit code
+	int (*run)(void* const ctx, const size_t job, const unsigned worker);
+
+	// called in the parent process after the job has terminated, with its wait status
+	void (*done)(void* const ctx, const size_t job, const int status);
+
+	// called in the parent process before the job is started while other jobs are running;
+	// returning false defers the job until another one terminates (optional)
+	bool (*admit)(void* const ctx, const size_t job);
+
+	// called in the parent process before the job is started; returning false skips the job,
+	// for instance, when it has been taken by another process (optional)
+	bool (*claim)(void* const ctx, const size_t job);
+
+	// user context
+	void* ctx;
+
+	// keep starting new jobs after a job has failed
+	bool keep_going;
+} job_runner;
+
+// run the given number of jobs in order on at most num_workers processes; once a job fails,
+// no new jobs are started, unless keep_going is set. Returns the wait status of
+// the first failed job, or 0.
+int run_jobs(const job_runner* const runner, const size_t num_jobs, const unsigned num_workers);
+
+// allocate zero-initialised memory shared with the child processes
+void* shared_alloc(const size_t size);
+
+// parse the argument of -j,--jobs option
+unsigned parse_num_jobs(const char* const arg);
@@ -0,0 +1,156 @@
+#include "journal.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+
+// journal file name, relative to the project directory
+#define JOURNAL_FILE ".ocr-journal"
+
+// status names, as written to the journal
+static const char* const status_names[] = { "none", "done", "blank", "failed", "text" };
+
+static
+int cmp_entries(const void* const a, const void* const b)
+{
+	const unsigned x = ((const journal_entry*)a)->page, y = ((const journal_entry*)b)->page;
+
+	return (x > y) - (x < y);
+}
+
+// entry with its position in the file
+typedef struct
+{
+	journal_entry entry;
+	size_t seq;
+} seq_entry;
+
+static
+int cmp_seq_entries(const void* const a, const void* const b)
+{
+	const seq_entry* const x = a;
+	const seq_entry* const y = b;
+	const int ret = cmp_entries(&x->entry, &y->entry);
+
+	return ret ? ret : (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+// parse one journal line: page number, status, number of attempts, and time stamp,
+// separated by tabs; returns false on a malformed line, like one cut short by a crash
+static
+bool parse_line(const char* const line, journal_entry* const entry)
+{
+	unsigned page, attempts;
+	long long stamp;
+	char status[16];
+	const size_t len = strlen(line);
+
+	if(len == 0 || line[len - 1] != '\n'
+		|| sscanf(line, "%u\t%15[a-z]\t%u\t%lld", &page, status, &attempts, &stamp) != 4)
+		return false;
+
+	for(page_status s = PAGE_NONE; s <= PAGE_TEXT; ++s)
+	{
+		if(strcmp(status, status_names[s]) == 0)
+		{
+			*entry = (journal_entry){ page, s };
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static
+void load_entries(journal* const j)
+{
+	FILE* const stream = fdopen(dup(j->fd), "r");
+
+	if(!stream)
+		die(errno, "cannot read file \"%s\"", j->name);
+
+	char* line = NULL;
+	size_t cap = 0, n = 0, num_cap = 0;
+	seq_entry* list = NULL;
+
+	while(getline(&line, &cap, stream) >= 0)
+	{
+		if(n == num_cap)
+		{
+			num_cap = num_cap ? 2 * num_cap : 256;
+			list = mem_realloc(list, num_cap * sizeof(seq_entry));
+		}
+
+		if(parse_line(line, &list[n].entry))
+		{
+			list[n].seq = n;
+			++n;
+		}
+	}
+
+	if(ferror(stream))
+		die(errno, "error reading file \"%s\"", j->name);
+
+	mem_free(line);
+	just(fclose(stream));
+
+	// keep the latest entry per page
+	qsort(list, n, sizeof(seq_entry), cmp_seq_entries);
+
+	journal_entry* const entries = mem_alloc(max(n, (size_t)1) * sizeof(journal_entry));
+	size_t len = 0;
+
+	for(size_t i = 0; i < n; ++i)
+	{
+		if(i + 1 == n || list[i + 1].entry.page != list[i].entry.page)
+			entries[len++] = list[i].entry;
+	}
+
+	mem_free(list);
+
+	j->len = len;
+	j->entries = entries;
+}
+
+void journal_open(journal* const j, const char* const dir)
+{
+	*j = (journal){ .fd = -1 };
+
+	just(asprintf(&j->name, "%s/" JOURNAL_FILE, dir));
+
+	if((j->fd = open(j->name, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0)
+		die(errno, "cannot open file \"%s\"", j->name);
+
+	load_entries(j);
+}
+
+void journal_close(journal* const j)
+{
+	if(j->fd >= 0)
+		just(close(j->fd));
+
+	free(j->name);
+	mem_free(j->entries);
+
+	*j = (journal){ .fd = -1 };
+}
+
+page_status journal_status(const journal* const j, const unsigned page)
+{
+	const journal_entry key = { .page = page };
+	const journal_entry* const p = bsearch(&key, j->entries, j->len, sizeof(journal_entry), cmp_entries);
+
+	return p ? p->status : PAGE_NONE;
+}
+
+void journal_write(journal* const j, const unsigned page, const page_status status, const unsigned attempts)
+{
+	char line[80];
+
+	// one locked write(2) per line, so that the entries are never interleaved
+	const int n = snprintf(line, sizeof(line), "%u\t%s\t%u\t%lld\n",
+						   page, status_names[status], attempts, (long long)time(NULL));
+
+	append_line(j->fd, j->name, line, n);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "utils.h"
+
+// page outcome; PAGE_TEXT marks the pages whose text has been taken from the text layer
+// of the document by ocr-open
+typedef enum { PAGE_NONE, PAGE_DONE, PAGE_BLANK, PAGE_FAILED, PAGE_TEXT } page_status;
+
+// journal entry
+typedef struct
+{
+	unsigned page;
+	page_status status;
+} journal_entry;
+
+// journal of page outcomes in the project directory; entries are appended as the pages
+// are processed, and the latest entry for a page wins
+typedef struct
+{
+	int fd;
+	char* name;
+	size_t len;
+	journal_entry* entries;	// latest entry per page, sorted by page number
+} journal;
+
+// open the journal in the given directory, creating it if needed, and load its entries
+void journal_open(journal* const j, const char* const dir);
+
+// close the journal
+void journal_close(journal* const j);
+
+// latest recorded status of the given page
+page_status journal_status(const journal* const j, const unsigned page);
+
+// append the outcome of the given page
+void journal_write(journal* const j, const unsigned page, const page_status status, const unsigned attempts);
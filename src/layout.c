@@ -0,0 +1,236 @@
+#include "layout.h"
+
+#include <string.h>
+
+// column profiles are built from every SAMPLE_STEP-th row
+#define SAMPLE_STEP 2
+
+static
+region_list* add_region(region_list* list, const pgm_region region)
+{
+	if(!list)
+	{
+		const size_t cap = 8;
+
+		list = mem_alloc(sizeof(region_list) + cap * sizeof(pgm_region));
+
+		list->len = 0;
+		list->cap = cap;
+	}
+	else if(list->len == list->cap)
+	{
+		list->cap *= 2;
+		list = mem_realloc(list, sizeof(region_list) + list->cap * sizeof(pgm_region));
+	}
+
+	list->regions[list->len++] = region;
+
+	return list;
+}
+
+// splitter state
+typedef struct
+{
+	const pgm_image* img;
+	size_t max_pixels;
+	unsigned char level;	// pixels darker than this are ink
+	unsigned min_gutter, min_band, min_col, min_row;
+	unsigned *profile, *cuts, *gaps;
+} splitter;
+
+// ink test for the pixel x of the given row
+static inline
+unsigned is_ink(const splitter* const sp, const unsigned char* const row, const unsigned x)
+{
+	if(sp->img->packed)
+		return (row[x / 8] >> (7 - x % 8)) & 1;
+
+	return row[x] < sp->level;
+}
+
+// number of dark pixels per column, from every SAMPLE_STEP-th row
+static
+unsigned column_profile(const splitter* const sp, const pgm_region* const r)
+{
+	unsigned* const prof = sp->profile;
+	const size_t stride = pgm_row_size(sp->img);
+	const unsigned char* row = sp->img->pixels + r->y * stride;
+
+	memset(prof, 0, r->width * sizeof(unsigned));
+
+	unsigned n = 0;
+
+	for(unsigned y = 0; y < r->height; y += SAMPLE_STEP, row += SAMPLE_STEP * stride, ++n)
+		for(unsigned x = 0; x < r->width; ++x)
+			prof[x] += is_ink(sp, row, r->x + x);
+
+	return n;
+}
+
+// number of dark pixels per row
+static
+void row_profile(const splitter* const sp, const pgm_region* const r)
+{
+	unsigned* const prof = sp->profile;
+	const size_t stride = pgm_row_size(sp->img);
+	const unsigned char* row = sp->img->pixels + r->y * stride;
+
+	for(unsigned y = 0; y < r->height; ++y, row += stride)
+	{
+		unsigned n = 0;
+
+		for(unsigned x = 0; x < r->width; ++x)
+			n += is_ink(sp, row, r->x + x);
+
+		prof[y] = n;
+	}
+}
+
+// centres and lengths of blank runs of at least min_run length, strictly inside
+// the content; the content bounds are returned via pfirst and plast
+static
+unsigned find_gaps(const splitter* const sp, const unsigned n, const unsigned tol, const unsigned min_run,
+				   unsigned* const pfirst, unsigned* const plast)
+{
+	const unsigned* const prof = sp->profile;
+
+	// content bounds
+	unsigned first = 0, last = n;
+
+	while(first < n && prof[first] <= tol)
+		++first;
+
+	while(last > first && prof[last - 1] <= tol)
+		--last;
+
+	*pfirst = first;
+	*plast = last;
+
+	// blank runs
+	unsigned num_gaps = 0;
+
+	for(unsigned i = first; i < last; )
+	{
+		if(prof[i] > tol)
+		{
+			++i;
+			continue;
+		}
+
+		const unsigned start = i;
+
+		while(i < last && prof[i] <= tol)
+			++i;
+
+		if(i - start >= min_run)
+		{
+			sp->cuts[num_gaps] = start + (i - start) / 2;
+			sp->gaps[num_gaps++] = i - start;
+		}
+	}
+
+	return num_gaps;
+}
+
+static
+region_list* xy_cut(const splitter* const sp, const pgm_region r, region_list* list)
+{
+	if((size_t)r.width * r.height <= sp->max_pixels)
+		return add_region(list, r);
+
+	unsigned first, last;
+
+	// vertical gutters: keep those leaving columns of at least min_col pixels wide
+	const unsigned samples = column_profile(sp, &r);
+	const unsigned num_gaps = find_gaps(sp, r.width, samples / 200, sp->min_gutter, &first, &last);
+
+	unsigned num_cuts = 0, prev = first;
+
+	for(unsigned i = 0; i < num_gaps; ++i)
+	{
+		const unsigned c = sp->cuts[i];
+
+		if(c - prev >= sp->min_col && last - c >= sp->min_col)
+			sp->cuts[num_cuts++] = prev = c;
+	}
+
+	if(num_cuts > 0)
+	{
+		// the cuts are overwritten by recursive calls
+		unsigned cuts[num_cuts];
+
+		memcpy(cuts, sp->cuts, sizeof(cuts));
+
+		unsigned x = 0;
+
+		for(unsigned i = 0; i <= num_cuts; ++i)
+		{
+			const unsigned end = (i < num_cuts) ? cuts[i] : r.width;
+
+			list = xy_cut(sp, (pgm_region){ r.x + x, r.y, end - x, r.height }, list);
+			x = end;
+		}
+
+		return list;
+	}
+
+	// horizontal bands: take the tallest one, as it is the most likely to separate
+	// independent blocks (like a headline spanning several columns), and among
+	// those of equal height take the one closest to the middle
+	row_profile(sp, &r);
+
+	const unsigned num_bands = find_gaps(sp, r.height, r.width / 200, sp->min_band, &first, &last);
+	const unsigned mid = first + (last - first) / 2;
+	unsigned cut = 0, gap = 0;
+
+	for(unsigned i = 0; i < num_bands; ++i)
+	{
+		const unsigned c = sp->cuts[i], g = sp->gaps[i];
+
+		if(c - first >= sp->min_row && last - c >= sp->min_row
+		   && (g > gap || (g == gap && abs((int)c - (int)mid) < abs((int)cut - (int)mid))))
+		{
+			cut = c;
+			gap = g;
+		}
+	}
+
+	if(cut == 0)
+		return add_region(list, r);	// cannot split any further
+
+	list = xy_cut(sp, (pgm_region){ r.x, r.y, r.width, cut }, list);
+
+	return xy_cut(sp, (pgm_region){ r.x, r.y + cut, r.width, r.height - cut }, list);
+}
+
+region_list* split_page(const pgm_image* const img, const size_t max_pixels)
+{
+	const pgm_region page = { 0, 0, img->width, img->height };
+
+	if(img->maxval > 255)
+		return add_region(NULL, page);
+
+	const unsigned n = max(img->width, img->height);
+
+	splitter sp =
+	{
+		.img = img,
+		.max_pixels = max_pixels,
+		.level = (img->maxval + 1) / 2,
+		.min_gutter = max(img->width / 150, 8u),
+		.min_band = max(img->height / 400, 4u),
+		.min_col = max(img->width / 20, 16u),
+		.min_row = max(img->height / 20, 16u),
+		.profile = mem_alloc(n * sizeof(unsigned)),
+		.cuts = mem_alloc(n * sizeof(unsigned)),
+		.gaps = mem_alloc(n * sizeof(unsigned))
+	};
+
+	region_list* const list = xy_cut(&sp, page, NULL);
+
+	mem_free(sp.profile);
+	mem_free(sp.cuts);
+	mem_free(sp.gaps);
+
+	return list;
+}
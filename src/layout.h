@@ -0,0 +1,17 @@
+#pragma once
+
+#include "pgm.h"
+
+// list of page regions
+typedef struct
+{
+	size_t len, cap;
+	pgm_region regions[];
+} region_list;
+
+// split the page image along whitespace gutters into regions of at most max_pixels
+// pixels each, where possible. Regions are listed in reading order: columns from
+// left to right, and blocks within each column from top to bottom.
+region_list* split_page(const pgm_image* const img, const size_t max_pixels);
+
+#define free_region_list(list)	mem_free((void*)(list))
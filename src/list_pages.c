@@ -3,6 +3,7 @@
 
 #include <string.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 
 // error check for child process
@@ -34,10 +35,10 @@ void child_proc(const char* const dir, const char* const ext, int pfd[2])
 	// format regex
 	char regex[100];
 
-	sprintf(regex, ".*/page-[0-9]{1,4}\\.%s$", ext);
+	sprintf(regex, ".*/page-[0-9]{1,%u}\\.%s$", MAX_PAGE_DIGITS, ext);
 
-	// exec command
-	_just(execlp("find", program_invocation_name, dir, "-maxdepth", "1",
+	// exec command; the second level is for the shard directories
+	_just(execlp("find", program_invocation_name, dir, "-maxdepth", "2",
 				 "-regextype", "posix-egrep", "-type", "f", "-regex", regex,
 				 "-print0", NULL));
 }
@@ -93,27 +94,99 @@ unsigned page_no(const str name, const str ext)
 	return page_no;
 }
 
+// check if the file is either in the directory itself, or in a shard subdirectory
+static
+bool is_page_path(const str name, const size_t dir_len)
+{
+	const char* const rel = str_ptr(name) + dir_len;
+	const char* const slash = strchr(rel, '/');
+
+	if(!slash)
+		return true;
+
+	if(slash == rel)
+		return false;
+
+	for(const char* s = rel; s < slash; ++s)
+		if(*s < '0' || *s > '9')
+			return false;
+
+	return true;
+}
+
 static
 str_list* apply_spec(str_list* const src,
 					 const page_spec* const spec,
+					 const char* const dir,
 					 const char* const ext)
 {
-	if(!spec || str_list_is_empty(src))
+	if(str_list_is_empty(src))
 		return src;
 
+	// find(1) prints the directory name as given, followed by a slash
+	const size_t len = strlen(dir);
+	const size_t dir_len = (len > 0 && dir[len - 1] == '/') ? len : (len + 1);
+
 	const str e = str_ref(ext);
 	str_list* res = NULL;
 	const str* const end = src->strings + src->len;
 
 	for(str* s = src->strings; s < end; ++s)
-		if(find_page_range(spec, page_no(*s, e)))
+		if(is_page_path(*s, dir_len) && (!spec || find_page_range(spec, page_no(*s, e))))
 			res = str_list_append(res, str_move(s));
 
 	str_list_free(src);
 	return res;
 }
 
-str_list* list_files(const char* const dir,
+// sort by page number, then by name
+typedef struct
+{
+	unsigned page;
+	str name;
+} page_key;
+
+static
+int cmp_page_keys(const void* const a, const void* const b)
+{
+	const page_key* const x = a;
+	const page_key* const y = b;
+
+	if(x->page != y->page)
+		return (x->page > y->page) - (x->page < y->page);
+
+	return strcmp(str_ptr(x->name), str_ptr(y->name));
+}
+
+static
+void sort_by_page_no(str_list* const list, const char* const ext)
+{
+	const str e = str_ref(ext);
+	page_key* const keys = mem_alloc(list->len * sizeof(page_key));
+
+	for(size_t i = 0; i < list->len; ++i)
+		keys[i] = (page_key){ page_no(list->strings[i], e), list->strings[i] };
+
+	qsort(keys, list->len, sizeof(page_key), cmp_page_keys);
+
+	for(size_t i = 0; i < list->len; ++i)
+		list->strings[i] = keys[i].name;
+
+	mem_free(keys);
+}
+
+char* sharded_page_name(const char* const dir, const unsigned page, const char* const ext)
+{
+	char* name = NULL;
+
+	just(asprintf(&name, "%s/%04u/page-%0*u.%s", dir, page / PAGES_PER_SHARD, MAX_PAGE_DIGITS, page, ext));
+
+	return name;
+}
+
+// page files in the directory and its shard subdirectories
+static
+str_list* find_files(const char* const dir,
 					 const page_spec* const spec,
 					 const char* const ext)
 {
@@ -143,11 +216,80 @@ str_list* list_files(const char* const dir,
 	check_exit_status(status);
 
 	// apply spec
-	list = apply_spec(list, spec, ext);
+	return apply_spec(list, spec, dir, ext);
+}
+
+str_list* list_files(const char* const dir,
+					 const page_spec* const spec,
+					 const char* const ext)
+{
+	str_list* list = find_files(dir, spec, ext);
+
+	// the RAM store; the trailing slash makes find(1) follow the link
+	char* store = NULL;
+	struct stat info;
+
+	just(asprintf(&store, "%s/" RAM_STORE_DIR "/", dir));
+
+	const bool has_store = (stat(store, &info) == 0 && S_ISDIR(info.st_mode));
+
+	if(has_store)
+	{
+		str_list* const ram = find_files(store, spec, ext);
+
+		for(size_t i = 0; i < str_list_len(ram); ++i)
+			list = str_list_append(list, str_move(&ram->strings[i]));
+
+		str_list_free(ram);
+	}
 
 	// sort
 	if(list)
-		str_sort_range(str_order_asc, list->strings, list->len);
+		sort_by_page_no(list, ext);
 
+	// a page being spilled from the RAM store is briefly in both places; the RAM store
+	// names sort first
+	if(has_store && list && list->len > 1)
+	{
+		const str e = str_ref(ext);
+		const str ram = str_ref(store);
+		size_t n = 1;
+
+		for(size_t i = 1; i < list->len; ++i)
+		{
+			const str prev = list->strings[n - 1], cur = list->strings[i];
+
+			if(page_no(prev, e) == page_no(cur, e) && str_has_prefix(prev, ram) && !str_has_prefix(cur, ram))
+				str_free(cur);
+			else
+				list->strings[n++] = cur;
+		}
+
+		list->len = n;
+	}
+
+	free(store);
 	return list;
 }
+
+char* page_file_ext(const str file, const char* const ext)
+{
+	const char* const s = str_ptr(file);
+	const char* const dot = strrchr(s, '.');
+	const char* const ram = strstr(s, "/" RAM_STORE_DIR "/");
+	char* name = NULL;
+
+	if(!dot)
+		die(0, "internal error (no extension in file name \"%s\")", s);
+
+	if(ram && ram < dot)
+	{
+		const char* const rest = ram + sizeof(RAM_STORE_DIR);	// from the slash after the store
+
+		just(asprintf(&name, "%.*s%.*s%s", (int)(ram - s), s, (int)(dot + 1 - rest), rest, ext));
+	}
+	else
+		just(asprintf(&name, "%.*s%s", (int)(dot + 1 - s), s, ext));
+
+	return name;
+}
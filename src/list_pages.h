@@ -3,8 +3,25 @@
 #include "page_spec.h"
 #include "str.h"
 
+// pages per shard directory: in the sharded layout, page N is stored in subdirectory
+// N / PAGES_PER_SHARD (as 4 digits) of the project directory, like "0012/page-001234.pgm"
+#define PAGES_PER_SHARD 100
+
+// RAM store of the page images, relative to the project directory: a link to a directory
+// in memory, with the same layout as the project directory
+#define RAM_STORE_DIR ".ocr-ram"
+
 unsigned page_no(const str name, const str ext);
 
+// list page files in the directory and its shard subdirectories, and in the RAM store of
+// the directory, if any, ordered by page number
 str_list* list_files(const char* const dir,
 					 const page_spec* const spec,
-					 const char* const ext);
\ No newline at end of file
+					 const char* const ext);
+
+// name of the page file in the sharded layout
+char* sharded_page_name(const char* const dir, const unsigned page, const char* const ext);
+
+// name of the file with the given extension for the page file, like the text file for the
+// page image; the name is in the project directory even for the images kept in the RAM store
+char* page_file_ext(const str file, const char* const ext);
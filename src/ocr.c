@@ -2,18 +2,33 @@
 #include "tesseract.h"
 #include "page_spec.h"
 #include "list_pages.h"
+#include "pgm.h"
+#include "layout.h"
+#include "jobs.h"
+#include "journal.h"
+#include "trace.h"
+#include "run_stats.h"
+#include "spool.h"
 
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <getopt.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <math.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <time.h>
 
 #define info(fmt, ...) just(printf("%s: " fmt "\n", program_invocation_name, ##__VA_ARGS__))
 
 static const char usage_string[] =
 	"Usage:\t" PROG_NAME " [OPTION]... [ -- TESSERACT-OPTION...]\n\n"
-	"Run OCR on the specified range of pages.\n\n"
+	"Run OCR on the specified range of pages, or on the pages of several projects.\n\n"
 	"Options:\n"
 	"  -p,--pages=SPEC\n"
 	"         Pages to list. A page specification contains one or more comma-separated page\n"
@@ -27,19 +42,183 @@ static const char usage_string[] =
 	"         Input directory (optional, default: .)\n\n"
 	"  -f,--fail-on-empty\n"
 	"         Fail if no files found.\n\n"
+	"  -b,--blank=PERCENT\n"
+	"         Treat pages with less than PERCENT of dark pixels as blank. Blank pages are not\n"
+	"         passed to tesseract; an empty text file is written for each of them instead.\n"
+	"         (optional, default: no blank page detection)\n\n"
+	"  -F,--fast=TESSERACT-OPTIONS\n"
+	"         Two-tier recognition: first run tesseract on each page with the given space-separated\n"
+	"         options (for example, \"-l eng --tessdata-dir /usr/share/tessdata_fast\"), then\n"
+	"         re-run it with the options after \"--\" only on pages where the mean word confidence\n"
+	"         is below the threshold set by -c option.\n"
+	"         (optional, default: single-tier recognition)\n\n"
+	"  -c,--min-conf=N\n"
+	"         Confidence threshold for two-tier recognition, from 0 to 100.\n"
+	"         (optional, default: 80)\n\n"
+	"  -k,--keep-going\n"
+	"         Do not stop on pages that tesseract fails to recognise; report them at the end\n"
+	"         instead. The outcome of each page is recorded in \".ocr-journal\" file in the input\n"
+	"         directory.\n\n"
+	"  -r,--retries=N\n"
+	"         Retry a failed page up to N times, waiting 1, 2, 4, and so on seconds before\n"
+	"         each attempt.\n"
+	"         (optional, default: 2 with -k option, otherwise 0)\n\n"
+	"  -R,--resume\n"
+	"         Skip the pages recorded as done in the journal by previous runs, so that only\n"
+	"         the unfinished and the failed pages are processed.\n\n"
+	"  -O,--force-ocr\n"
+	"         Also recognise the pages whose text has been taken from the text layer of the\n"
+	"         document by \"ocr-open -t\", once their images are rendered by \"ocr-open\"\n"
+	"         without -t; such pages are skipped by default.\n\n"
+	"  -t,--timeout=SEC\n"
+	"         Kill tesseract if it runs on a page (or a page region) for longer than SEC seconds\n"
+	"         of wall-clock time. Killed pages are reported as failed without stopping the run.\n"
+	"         (optional, default: no limit)\n\n"
+	"  -U,--cpu-time=SEC\n"
+	"         Kill tesseract if it uses more than SEC seconds of CPU time on a page.\n"
+	"         (optional, default: no limit)\n\n"
+	"  -m,--max-memory=MB\n"
+	"         Kill tesseract if its resident memory exceeds MB megabytes.\n"
+	"         (optional, default: no limit)\n\n"
+	"  -j,--jobs=N\n"
+	"         Number of pages (or page regions) to recognise in parallel.\n"
+	"         (optional, default: 1)\n\n"
+	"  -M,--mem-budget=MB\n"
+	"         Start a new tesseract run only while the sum of the estimated peak memory of\n"
+	"         all the runs stays within MB megabytes. The estimate is based on the image size\n"
+	"         and on the peak memory of the previous runs with the same languages, recorded\n"
+	"         in \".ocr-stats\" file in the input directory.\n"
+	"         (optional, default: no limit)\n\n"
+	"  -n,--chunk=N\n"
+	"         Recognise up to N pages in one tesseract run, so that the language models are\n"
+	"         loaded once per run rather than once per page. The pages are shared between the\n"
+	"         runs so that each parallel job gets several of them; a run that fails is repeated\n"
+	"         page by page, so that only the failing pages are reported. Time limits set by -t\n"
+	"         and -U options are multiplied by the number of pages in the run. Cannot be combined\n"
+	"         with -F option.\n"
+	"         (optional, default: 1)\n\n"
+	"  -L,--longest-first\n"
+	"         Start the pages in the order of their estimated recognition time, longest first,\n"
+	"         to shorten the tail of a parallel run. The estimate is based on the image size,\n"
+	"         the fraction of dark pixels, and on the time of the previous runs with the same\n"
+	"         languages, recorded in \".ocr-stats\" file. The pages are still reported, and\n"
+	"         recorded in the journal, in page order, except with -W,--worker, where each page\n"
+	"         is reported as soon as it is done.\n\n"
+	"  -s,--split=MPIX\n"
+	"         Split pages larger than MPIX megapixels along whitespace gutters and between\n"
+	"         paragraphs into regions that are recognised in parallel, then join the text\n"
+	"         of the regions in reading order. Useful for newspaper pages and two-page spreads.\n"
+	"         With -W,--worker, a page is split by the worker that claims it, and its regions\n"
+	"         are recognised one after another.\n"
+	"         (optional, default: no splitting)\n\n"
+	"  -B,--batch=FILE\n"
+	"         Process the pages of all the projects listed in FILE, one project per line,\n"
+	"         sharing the parallel jobs fairly between the projects. A line contains the project\n"
+	"         directory, optionally followed by \"-p SPEC\" page specification, and by \"--\" with\n"
+	"         tesseract options for the project; by default, the options after \"--\" on the command\n"
+	"         line are used. Empty lines and lines starting with '#' are ignored. Cannot be combined\n"
+	"         with -d and -p options.\n\n"
+	"  -W,--worker\n"
+	"         Share the pages with other \"ocr -W\" processes running on the same project, on this\n"
+	"         or other hosts sharing the project directory. The first worker puts the pages into\n"
+	"         the queue in \".ocr-spool\" directory, and each worker recognises only the pages it\n"
+	"         has claimed from the queue. Workers keep a heartbeat file; the pages claimed by\n"
+	"         a worker whose heartbeat is older than the lease are given back to the queue.\n"
+	"         Each worker exits once all the pages are done; the next run queues the pages\n"
+	"         again.\n\n"
+	"  -e,--lease=SEC\n"
+	"         Lease of the pages claimed by a worker, in seconds.\n"
+	"         (optional, default: 60)\n\n"
+	"  -T,--trace=FILE\n"
+	"         Write the timeline of the run to FILE in the trace-event format of chrome://tracing\n"
+	"         and Perfetto, with one lane per job, and the spans of process start-up, image\n"
+	"         validation, recognition, and output writing for every page.\n\n"
 	"  -h,--help\n"
 	"         Show help and exit.\n\n"
 	"  -v,--version\n"
 	"         Show version and exit.\n";
 
+// numeric option parser; the number may be followed by the given suffix
+static
+double parse_number(const char* const arg, const char* const opt, const char* const suffix)
+{
+	char* end;
+
+	errno = 0;
+
+	const double val = strtod(arg, &end);
+
+	if(end == arg || errno != 0 || !isfinite(val) || (*end != 0 && (!suffix || strcmp(end, suffix) != 0)))
+		die(0, "invalid argument for %s option: \"%s\"", opt, arg);
+
+	return val;
+}
+
+#define die_out_of_range(opt, arg)	\
+	die(0, "argument for %s option is out of range: \"%s\"", (opt), (arg))
+
+// resource limit: a whole number from 1 to 1000000
+static
+unsigned parse_limit(const char* const arg, const char* const opt)
+{
+	const double val = parse_number(arg, opt, NULL);
+
+	if(val != floor(val) || val < 1 || val > 1e6)
+		die_out_of_range(opt, arg);
+
+	return val;
+}
+
+// split space-separated list of words, modifying the string in place
+static
+const char** split_words(char* const s, unsigned* const pnum)
+{
+	const char** list = NULL;
+	unsigned n = 0;
+	char* save;
+
+	for(char* tok = strtok_r(s, " \t\n", &save); tok; tok = strtok_r(NULL, " \t\n", &save))
+	{
+		list = mem_realloc(list, (n + 1) * sizeof(char*));
+		list[n++] = tok;
+	}
+
+	*pnum = n;
+	return list;
+}
+
+// split space-separated list of options
+static
+const char** split_options(const char* const arg, unsigned* const pnum)
+{
+	char* const s = strdup(arg);
+
+	if(!s)
+		die(errno, "internal error");
+
+	const char** const list = split_words(s, pnum);
+
+	if(*pnum == 0)
+		die(0, "empty parameter specified for -F,--fast option");
+
+	return list;
+}
+
 // option parser
 typedef struct
 {
-	const char* dir;
+	const char *dir, *batch, *trace;
 	page_spec* spec;
-	bool fail_on_empty;
+	bool fail_on_empty, keep_going, resume, force_ocr, longest_first, worker;
+	double blank, min_conf, split;
+	unsigned jobs, chunk, lease;
+	uint64_t mem_budget;
+	int retries;
+	tess_limits limits;
 	const char** tess_argv;
 	unsigned tess_argc;
+	const char** fast_argv;
+	unsigned fast_argc;
 } command;
 
 static
@@ -52,18 +231,37 @@ void parse_options(command* const cmd, int argc, char* argv[])
 		{"pages",  required_argument, NULL, 'p'},
 		{"dir",  required_argument, NULL, 'd'},
 		{"fail-on-empty",  no_argument, NULL, 'f'},
+		{"blank",  required_argument, NULL, 'b'},
+		{"fast",  required_argument, NULL, 'F'},
+		{"min-conf",  required_argument, NULL, 'c'},
+		{"split",  required_argument, NULL, 's'},
+		{"jobs",  required_argument, NULL, 'j'},
+		{"mem-budget",  required_argument, NULL, 'M'},
+		{"chunk",  required_argument, NULL, 'n'},
+		{"longest-first",  no_argument, NULL, 'L'},
+		{"keep-going",  no_argument, NULL, 'k'},
+		{"retries",  required_argument, NULL, 'r'},
+		{"resume",  no_argument, NULL, 'R'},
+		{"force-ocr",  no_argument, NULL, 'O'},
+		{"timeout",  required_argument, NULL, 't'},
+		{"cpu-time",  required_argument, NULL, 'U'},
+		{"max-memory",  required_argument, NULL, 'm'},
+		{"batch",  required_argument, NULL, 'B'},
+		{"worker",  no_argument, NULL, 'W'},
+		{"lease",  required_argument, NULL, 'e'},
+		{"trace",  required_argument, NULL, 'T'},
 		{"help",  no_argument, NULL, 'h'},
 		{"version",  no_argument, NULL, 'v'},
 		{NULL, 0, NULL, 0}
 	};
 
 	// prepare target
-	*cmd = (command){ .dir = "." };
+	*cmd = (command){ .dir = ".", .min_conf = 80, .jobs = 1, .chunk = 1, .lease = 60, .retries = -1 };
 
 	// parser loop
 	int opt, option_index = 0;
 
-	while((opt = getopt_long(argc, argv, "+p:d:fhv", long_options, &option_index)) >= 0)
+	while((opt = getopt_long(argc, argv, "+p:d:fb:F:c:s:j:M:n:Lkr:ROt:U:m:B:We:T:hv", long_options, &option_index)) >= 0)
 	{
 		switch(opt)
 		{
@@ -84,6 +282,97 @@ void parse_options(command* const cmd, int argc, char* argv[])
 			case 'f':
 				cmd->fail_on_empty = true;
 				break;
+			case 'b':
+				cmd->blank = parse_number(optarg, "-b,--blank", "%");
+
+				if(cmd->blank <= 0 || cmd->blank >= 100)
+					die_out_of_range("-b,--blank", optarg);
+
+				cmd->blank /= 100;
+				break;
+			case 'F':
+				mem_free(cmd->fast_argv);
+				cmd->fast_argv = split_options(optarg, &cmd->fast_argc);
+				break;
+			case 'c':
+				cmd->min_conf = parse_number(optarg, "-c,--min-conf", NULL);
+
+				if(cmd->min_conf < 0 || cmd->min_conf > 100)
+					die_out_of_range("-c,--min-conf", optarg);
+
+				break;
+			case 's':
+				cmd->split = parse_number(optarg, "-s,--split", NULL) * 1e6;
+
+				if(cmd->split < 1e6)
+					die_out_of_range("-s,--split", optarg);
+
+				break;
+			case 'j':
+				cmd->jobs = parse_num_jobs(optarg);
+				break;
+			case 'k':
+				cmd->keep_going = true;
+				break;
+			case 'r':
+			{
+				const double n = parse_number(optarg, "-r,--retries", NULL);
+
+				if(n != floor(n) || n < 0 || n > 10)
+					die_out_of_range("-r,--retries", optarg);
+
+				cmd->retries = n;
+				break;
+			}
+			case 'R':
+				cmd->resume = true;
+				break;
+			case 'O':
+				cmd->force_ocr = true;
+				break;
+			case 't':
+				cmd->limits.timeout = parse_limit(optarg, "-t,--timeout");
+				break;
+			case 'U':
+				cmd->limits.cpu_time = parse_limit(optarg, "-U,--cpu-time");
+				break;
+			case 'm':
+				cmd->limits.max_rss = (unsigned long)parse_limit(optarg, "-m,--max-memory") << 20;
+				break;
+			case 'M':
+				cmd->mem_budget = (uint64_t)parse_limit(optarg, "-M,--mem-budget") << 20;
+				break;
+			case 'n':
+			{
+				const double n = parse_number(optarg, "-n,--chunk", NULL);
+
+				if(n != floor(n) || n < 1 || n > 1000)
+					die_out_of_range("-n,--chunk", optarg);
+
+				cmd->chunk = n;
+				break;
+			}
+			case 'L':
+				cmd->longest_first = true;
+				break;
+			case 'B':
+				if(*optarg == 0)
+					die(0, "empty file name specified for -B,--batch option");
+
+				cmd->batch = optarg;
+				break;
+			case 'W':
+				cmd->worker = true;
+				break;
+			case 'e':
+				cmd->lease = parse_limit(optarg, "-e,--lease");
+				break;
+			case 'T':
+				if(*optarg == 0)
+					die(0, "empty file name specified for -T,--trace option");
+
+				cmd->trace = optarg;
+				break;
 			case 'h':
 				show_usage_and_exit(usage_string);
 				break;
@@ -97,6 +386,15 @@ void parse_options(command* const cmd, int argc, char* argv[])
 		}
 	}
 
+	if(cmd->retries < 0)
+		cmd->retries = cmd->keep_going ? 2 : 0;
+
+	if(cmd->batch && (cmd->spec || strcmp(cmd->dir, ".") != 0))
+		die(0, "option -B,--batch cannot be combined with -d,--dir and -p,--pages");
+
+	if(cmd->chunk > 1 && cmd->fast_argv)
+		die(0, "option -n,--chunk cannot be combined with -F,--fast");
+
 	// tesseract options
 	if(argc > optind)
 	{
@@ -105,6 +403,36 @@ void parse_options(command* const cmd, int argc, char* argv[])
 	}
 }
 
+// languages installed in the tessdata directory given by tesseract option --tessdata-dir,
+// or in the default one; the lists are loaded once per directory
+static
+const str_list* installed_langs(const char** args, const unsigned num_args)
+{
+	const char* dir = NULL;
+
+	for(unsigned i = 0; i + 1 < num_args; ++i)
+		if(strcmp(args[i], "--tessdata-dir") == 0)
+			dir = args[i + 1];
+
+	typedef struct
+	{
+		const char* dir;
+		const str_list* langs;
+	} lang_list;
+
+	static lang_list* cache = NULL;
+	static size_t num_cached = 0;
+
+	for(size_t i = 0; i < num_cached; ++i)
+		if(cache[i].dir == dir || (cache[i].dir && dir && strcmp(cache[i].dir, dir) == 0))
+			return cache[i].langs;
+
+	cache = mem_realloc(cache, (num_cached + 1) * sizeof(lang_list));
+	cache[num_cached] = (lang_list){ dir, tess_langs(dir) };
+
+	return cache[num_cached++].langs;
+}
+
 static
 void check_tess_lang_opt(const char** args, const unsigned num_args)
 {
@@ -127,9 +455,7 @@ void check_tess_lang_opt(const char** args, const unsigned num_args)
 		die(0, "empty argument for tesseract option -l");
 
 	const size_t len = strlen(spec);
-
-	// load list of supported languages
-	const str_list* const langs = tess_langs();
+	const str_list* const langs = installed_langs(args, num_args);
 
 	// match each part separated by '+'
 	for(const char* lang = spec; lang < spec + len; )
@@ -164,43 +490,1569 @@ void check_tess_lang_opt(const char** args, const unsigned num_args)
 			die(0, "only one tesseract '-l' option is allowed");
 }
 
-int main(int argc, char* argv[])
+// language set given by tesseract option -l, or the tesseract default
+static
+const char* tess_lang_set(const char** args, const unsigned num_args)
 {
-	// command line options
-	command cmd;
+	for(unsigned i = 0; i + 1 < num_args; ++i)
+		if(strcmp(args[i], "-l") == 0)
+			return args[i + 1];
 
-	parse_options(&cmd, argc, argv);
+	return "eng";
+}
 
-	// make sure stdin is closed on exec
-	just(fcntl(STDIN_FILENO, F_SETFD, fcntl(STDIN_FILENO, F_GETFD) | FD_CLOEXEC));
+// rows of the image sampled for the time estimates
+#define INK_SAMPLE_STEP 16
 
-	// check if tesseract is installed
-	tess_check();
+// fraction of dark pixels of the image, for blank page detection, or its estimate from
+// every INK_SAMPLE_STEP-th row, for the time estimates
+static
+double image_ink_ratio(const str file, const bool exact)
+{
+	pgm_image img;
 
-	// check language spec
-	check_tess_lang_opt(cmd.tess_argv, cmd.tess_argc);
+	pgm_map(&img, str_ptr(file));
+
+	const double ink = exact ? pgm_ink_ratio(&img) : pgm_ink_estimate(&img, INK_SAMPLE_STEP);
+
+	pgm_unmap(&img);
+
+	return ink;
+}
+
+// monotonic time in milliseconds
+static
+uint64_t time_msec(void)
+{
+	struct timespec ts;
+
+	just(clock_gettime(CLOCK_MONOTONIC, &ts));
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// name of the text file for the given image file
+static
+char* text_name(const str file)
+{
+	return page_file_ext(file, "txt");
+}
+
+static
+void write_empty_text(const str file)
+{
+	char* const txt = text_name(file);
+
+	const int fd = open(txt, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if(fd < 0)
+		die(errno, "cannot create file \"%s\"", txt);
+
+	just(close(fd));
+	free(txt);
+}
+
+// project: directory with page images, and tesseract options for it
+typedef struct
+{
+	const char* dir;
+	page_spec* spec;
+	const char** tess_argv;
+	unsigned tess_argc;
+	str_list* files;
+	journal journal;
+	run_stats stats;
+	spool spool;			// queue shared with the other workers
+	char* langs;			// language set of the tesseract runs, as recorded in the stats
+	char* tmp_dir;			// temporary directory for page regions and chunk lists
+	size_t pages_left;		// number of pages still to recognise
+	unsigned num_pages, num_failed;
+} ocr_project;
+
+// claim of the page from the queue shared with the other workers
+typedef enum { CLAIM_NONE, CLAIM_HELD, CLAIM_DONE } ocr_claim;
+
+// recognition job
+typedef struct
+{
+	ocr_project* project;
+	str file;				// image file
+	str page_file;			// page image file
+	unsigned page;			// page number
+	unsigned region;		// region number starting from 1, or 0 for the whole page
+	unsigned num_regions;	// number of regions on the page
+	size_t first;			// index of the first region job of the page
+	pgm_info info;			// page image info
+	double ink;				// fraction of dark pixels, or -1 if not measured yet
+	bool failed;			// page outcome, set on the first region job
+	unsigned attempts;
+	ocr_claim claim;		// claim of the page in worker mode, set on the first region job
+	bool split;				// page to split into regions by the job, in worker mode
+} ocr_job;
+
+// job result, written by the child process
+typedef enum { TIER_NONE, TIER_BLANK, TIER_FAST, TIER_BEST } ocr_tier;
+
+typedef struct
+{
+	double conf;
+	ocr_tier tier;
+	unsigned attempts;
+	int status;			// wait status of the last failed attempt
+	tess_status limit;	// resource limit exceeded by tesseract
+	uint64_t peak_rss;	// peak resident memory of tesseract, in bytes
+	uint64_t msec;		// time taken by tesseract
+	double ink;			// fraction of dark pixels
+	bool single;		// recognised on its own after its chunk has failed
+	int single_status;	// wait status of the page recognised on its own
+} ocr_result;
+
+// jobs recognised in one tesseract run: a range of the job order, with the jobs to run,
+// that is, those claimed in worker mode, at its front
+typedef struct
+{
+	size_t first, size, len;
+} ocr_chunk;
 
-	// get file list
-	str_list* const files = list_files(cmd.dir, cmd.spec, "pgm");
+// processing state
+typedef struct
+{
+	const command* cmd;
+	ocr_project* projects;
+	size_t num_projects;
+	ocr_job* jobs;
+	size_t num_jobs, cap;
+	size_t* order;			// order of the jobs to run
+	ocr_chunk* chunks;		// the order split into tesseract runs
+	size_t num_chunks;
+	ocr_result* results;	// shared with child processes
+	unsigned* remaining;	// number of regions still to recognise, per page
+	unsigned num_blank, num_fast, num_best, num_failed;
+	uint64_t spawn_time;	// time the last job was started, for the trace
+	uint64_t* mem_est;		// estimated peak memory of the running chunks
+	uint64_t mem_used;		// sum of the estimates of the running chunks
+	int* statuses;			// wait statuses of the jobs done, when reported in order
+	bool* finished;
+	size_t num_reported;
+} ocr_state;
 
-	if(str_list_is_empty(files))
+static
+size_t add_job(ocr_state* const st, const ocr_job job)
+{
+	if(st->num_jobs == st->cap)
 	{
-		if(cmd.fail_on_empty)
-			error(2, 0, "no pages found");
+		st->cap = st->cap ? 2 * st->cap : 64;
+		st->jobs = mem_realloc(st->jobs, st->cap * sizeof(ocr_job));
+	}
 
-		return 0;
+	st->jobs[st->num_jobs] = job;
+	st->jobs[st->num_jobs].ink = -1;
+
+	return st->num_jobs++;
+}
+
+// temporary directories for page regions and chunk lists
+static char** tmp_dirs = NULL;
+static size_t num_tmp_dirs = 0;
+static pid_t tmp_dir_owner = 0;
+
+static
+void remove_tmp_dirs(void)
+{
+	// child processes must leave the directories alone
+	if(getpid() != tmp_dir_owner)
+		return;
+
+	for(size_t i = 0; i < num_tmp_dirs; ++i)
+	{
+		DIR* const dir = opendir(tmp_dirs[i]);
+
+		if(dir)
+		{
+			for(const struct dirent* ent = readdir(dir); ent; ent = readdir(dir))
+				if(ent->d_name[0] != '.')
+					unlinkat(dirfd(dir), ent->d_name, 0);
+
+			closedir(dir);
+		}
+
+		rmdir(tmp_dirs[i]);
 	}
+}
 
-	// run OCR
-	for(size_t i = 0; i < files->len; ++i)
+static
+const char* get_tmp_dir(ocr_project* const project)
+{
+	if(!project->tmp_dir)
 	{
-		const str file = files->strings[i];
-		const unsigned page = page_no(file, str_lit("pgm"));
+		just(asprintf(&project->tmp_dir, "%s/.ocr-XXXXXX", project->dir));
+
+		if(!mkdtemp(project->tmp_dir))
+			die(errno, "cannot create temporary directory in \"%s\"", project->dir);
+
+		if(num_tmp_dirs == 0)
+		{
+			tmp_dir_owner = getpid();
+			just(atexit(remove_tmp_dirs));
+		}
+
+		tmp_dirs = mem_realloc(tmp_dirs, (num_tmp_dirs + 1) * sizeof(char*));
+		tmp_dirs[num_tmp_dirs++] = project->tmp_dir;
+	}
+
+	return project->tmp_dir;
+}
+
+// page name for messages, with the project directory in batch mode
+static
+void page_name(const ocr_state* const st, const ocr_project* const project, const unsigned page,
+			   char* const buff, const size_t size)
+{
+	if(st->cmd->batch)
+		snprintf(buff, size, "%s: page %u", project->dir, page);
+	else
+		snprintf(buff, size, "page %u", page);
+}
+
+// add recognition jobs for the given page
+static
+void add_region_jobs(ocr_state* const st, ocr_project* const project,
+					 const pgm_image* const img, const str file, const unsigned page)
+{
+	region_list* const regions = split_page(img, st->cmd->split);
+
+	if(regions->len == 1)
+	{
+		add_job(st, (ocr_job){
+			.project = project,
+			.file = file,
+			.page_file = file,
+			.page = page,
+			.info = pgm_get_info(img)
+		});
+
+		free_region_list(regions);
+		return;
+	}
+
+	char name[PATH_MAX + 64];
+
+	page_name(st, project, page, name, sizeof(name));
+	info("%s: split into %zu regions", name, regions->len);
+
+	const char* const dir = get_tmp_dir(project);
+	const size_t first = st->num_jobs;
+
+	for(unsigned i = 0; i < regions->len; ++i)
+	{
+		const pgm_region* const r = &regions->regions[i];
+		char* name = NULL;
+
+		just(asprintf(&name, "%s/page-%u.%u.pgm", dir, page, i + 1));
+
+		pgm_write_region(img, r, name);
+
+		add_job(st, (ocr_job){
+			.project = project,
+			.file = str_acquire(name),
+			.page_file = file,
+			.page = page,
+			.region = i + 1,
+			.num_regions = regions->len,
+			.first = first,
+			.info = { r->width, r->height, pgm_get_info(img).depth }
+		});
+	}
+
+	free_region_list(regions);
+}
 
-		info("processing page %u [ \"%s\" ]", page, str_ptr(file));
+// add recognition jobs for the given page; returns false if the page is blank
+static
+bool add_page_jobs(ocr_state* const st, ocr_project* const project, const str file, const pgm_info* const meta)
+{
+	const command* const cmd = st->cmd;
+	const unsigned page = page_no(file, str_lit("pgm"));
+	const bool large = (cmd->split > 0 && (double)meta->width * meta->height > cmd->split);
+
+	// in worker mode, the page is checked and split by the worker that claims it
+	if(large && cmd->worker)
+	{
+		get_tmp_dir(project);
+		add_job(st, (ocr_job){ .project = project, .file = file, .page_file = file, .page = page, .info = *meta,
+							   .split = true });
+		return true;
+	}
+
+	if(large)
+	{
+		pgm_image img;
+
+		pgm_map(&img, str_ptr(file));
+
+		const bool blank = (cmd->blank > 0 && pgm_ink_ratio(&img) < cmd->blank);
+
+		if(blank)
+		{
+			char name[PATH_MAX + 64];
+
+			page_name(st, project, page, name, sizeof(name));
+			info("%s: blank, skipped", name);
+
+			write_empty_text(file);
+			journal_write(&project->journal, page, PAGE_BLANK, 0);
+			++st->num_blank;
+		}
+		else
+			add_region_jobs(st, project, &img, file, page);
+
+		pgm_unmap(&img);
+		return !blank;
+	}
+
+	add_job(st, (ocr_job){ .project = project, .file = file, .page_file = file, .page = page, .info = *meta });
+
+	return true;
+}
+
+// read the whole text file, trimming trailing whitespace
+static
+char* read_text(const char* const name, size_t* const plen)
+{
+	FILE* const stream = fopen(name, "re");
+
+	if(!stream)
+		die(errno, "cannot open file \"%s\"", name);
+
+	char* text = NULL;
+	size_t cap = 0;
+	const ssize_t len = getdelim(&text, &cap, 0, stream);
+
+	if(ferror(stream))
+		die(errno, "error reading file \"%s\"", name);
+
+	just(fclose(stream));
+
+	size_t n = max(len, (ssize_t)0);
+
+	while(n > 0 && isspace((unsigned char)text[n - 1]))
+		--n;
+
+	*plen = n;
+	return text;
+}
+
+// join the texts of the region images into the page text, in reading order, and remove
+// the region images with their texts
+static
+void join_texts(const str page_file, const str* const files, const size_t num_files)
+{
+	char* const name = text_name(page_file);
+
+	FILE* const out = fopen(name, "we");
+
+	if(!out)
+		die(errno, "cannot create file \"%s\"", name);
+
+	bool empty = true;
+
+	for(size_t i = 0; i < num_files; ++i)
+	{
+		const str file = files[i];
+		char* const txt = text_name(file);
+
+		size_t len;
+		char* const text = read_text(txt, &len);
+
+		if(len > 0)
+		{
+			if(!empty)
+				just(fputs("\n\n", out));
+
+			if(fwrite(text, 1, len, out) != len)
+				die(errno, "error writing file \"%s\"", name);
+
+			empty = false;
+		}
 
-		tess_extract_text(file, cmd.tess_argv, cmd.tess_argc);
+		mem_free(text);
+		unlink(txt);
+		unlink(str_ptr(file));
+		free(txt);
 	}
 
+	if(!empty)
+		just(fputs("\n", out));
+
+	if(fclose(out) != 0)
+		die(errno, "error writing file \"%s\"", name);
+
+	free(name);
+}
+
+// join region texts into the page text
+static
+void join_regions(const ocr_state* const st, const size_t first)
+{
+	const ocr_job* const jobs = st->jobs + first;
+	str* const files = mem_alloc(jobs->num_regions * sizeof(str));
+
+	for(unsigned i = 0; i < jobs->num_regions; ++i)
+		files[i] = jobs[i].file;
+
+	join_texts(jobs->page_file, files, jobs->num_regions);
+	mem_free(files);
+}
+
+// estimated peak memory of the job, from the peak memory of the jobs done so far
+static
+uint64_t job_mem_estimate(const ocr_job* const job)
+{
+	return rss_estimate(&job->project->stats, job->project->langs, (uint64_t)job->info.width * job->info.height);
+}
+
+// job callbacks; the jobs are run in the order given by the state
+static
+void job_name(const ocr_state* const st, const ocr_job* const job, char* const buff, const size_t size)
+{
+	page_name(st, job->project, job->page, buff, size);
+
+	if(job->region > 0)
+	{
+		const size_t n = strlen(buff);
+
+		snprintf(buff + n, size - n, ", region %u of %u", job->region, job->num_regions);
+	}
+}
+
+static
+void report_start(const ocr_state* const st, const ocr_job* const job)
+{
+	if(job->region == 0)
+		info("processing page %u [ \"%s\" ]", job->page, str_ptr(job->file));
+	else
+	{
+		char name[PATH_MAX + 64];
+
+		job_name(st, job, name, sizeof(name));
+		info("processing %s", name);
+	}
+}
+
+// estimated peak memory of the chunk; tesseract keeps one page in memory at a time
+static
+uint64_t chunk_mem_estimate(const ocr_state* const st, const ocr_chunk* const c)
+{
+	uint64_t est = 0;
+
+	for(size_t k = 0; k < c->len; ++k)
+		est = max(est, job_mem_estimate(&st->jobs[st->order[c->first + k]]));
+
+	return est;
+}
+
+static
+void start_job(void* const ctx, const size_t n)
+{
+	ocr_state* const st = ctx;
+	const ocr_chunk* const c = &st->chunks[n];
+
+	st->spawn_time = trace_time();
+	st->mem_used += (st->mem_est[n] = chunk_mem_estimate(st, c));
+
+	if(!st->statuses)
+		for(size_t k = 0; k < c->len; ++k)
+			report_start(st, &st->jobs[st->order[c->first + k]]);
+}
+
+// in worker mode, run only the pages claimed from the queue, leaving the others to the other
+// workers; the chunk is cut down to the jobs of the claimed pages
+static
+bool claim_job(void* const ctx, const size_t n)
+{
+	ocr_state* const st = ctx;
+	ocr_chunk* const c = &st->chunks[n];
+	size_t* const jobs = st->order + c->first;
+
+	c->len = 0;
+
+	for(size_t k = 0; k < c->size; ++k)
+	{
+		const size_t i = jobs[k];
+		const ocr_job* const job = &st->jobs[i];
+		ocr_job* const page = &st->jobs[(job->region > 0) ? job->first : i];
+
+		if(page->claim == CLAIM_NONE && spool_claim(&job->project->spool, job->page))
+			page->claim = CLAIM_HELD;
+
+		if(page->claim == CLAIM_HELD)
+		{
+			jobs[k] = jobs[c->len];
+			jobs[c->len++] = i;
+		}
+	}
+
+	return c->len > 0;
+}
+
+// admit the chunk only while the estimated memory of the running chunks is within the budget
+static
+bool admit_job(void* const ctx, const size_t n)
+{
+	const ocr_state* const st = ctx;
+
+	return st->mem_used + chunk_mem_estimate(st, &st->chunks[n]) <= st->cmd->mem_budget;
+}
+
+// peak resident memory of the terminated child processes, that is, of tesseract
+static
+uint64_t children_peak_rss(void)
+{
+	struct rusage usage;
+
+	just(getrusage(RUSAGE_CHILDREN, &usage));
+
+	return (uint64_t)usage.ru_maxrss << 10;
+}
+
+// measure the ink of the page, and write an empty text for a blank page; returns true
+// if the page is blank. Without the blank check, the estimate is enough for the statistics.
+static
+bool check_blank(const ocr_state* const st, const size_t i, const unsigned lane)
+{
+	const command* const cmd = st->cmd;
+	const ocr_job* const job = &st->jobs[i];
+	ocr_result* const res = &st->results[i];
+
+	if(cmd->blank == 0)
+	{
+		res->ink = (job->ink >= 0) ? job->ink : image_ink_ratio(job->file, false);
+		return false;
+	}
+
+	uint64_t t = trace_time();
+
+	res->ink = image_ink_ratio(job->file, true);
+	trace_span("blank check", lane, job->page, t);
+
+	if(res->ink >= cmd->blank)
+		return false;
+
+	t = trace_time();
+	write_empty_text(job->file);
+	trace_span("write", lane, job->page, t);
+
+	res->tier = TIER_BLANK;
+	return true;
+}
+
+// recognise the image file, with the two-tier recognition if set up; a file killed
+// for exceeding the resource limits is reported, but does not stop the run
+static
+void recognise_file(const ocr_state* const st, const ocr_project* const project, const str file,
+					const unsigned page, const unsigned lane, ocr_result* const res)
+{
+	const command* const cmd = st->cmd;
+	uint64_t t = trace_time();
+
+	if(!cmd->fast_argv)
+	{
+		res->limit = tess_extract_text(file, project->tess_argv, project->tess_argc);
+		res->peak_rss = children_peak_rss();
+		trace_span("recognise", lane, page, t);
+		return;
+	}
+
+	// two-tier recognition
+	res->limit = tess_extract_text_conf(file, cmd->fast_argv, cmd->fast_argc, &res->conf);
+	res->peak_rss = children_peak_rss();
+	trace_span("recognise (fast)", lane, page, t);
+
+	if(res->limit != TESS_OK)
+		return;
+
+	if(res->conf >= cmd->min_conf)
+		res->tier = TIER_FAST;
+	else
+	{
+		t = trace_time();
+		res->limit = tess_extract_text(file, project->tess_argv, project->tess_argc);
+		res->peak_rss = children_peak_rss();
+		trace_span("recognise (best)", lane, page, t);
+		res->tier = TIER_BEST;
+	}
+}
+
+// split the page claimed in worker mode into regions, and recognise them one after another;
+// the page is reported with the lowest confidence and the highest tier of its regions
+static
+void recognise_regions(const ocr_state* const st, const size_t i, const unsigned lane)
+{
+	const ocr_job* const job = &st->jobs[i];
+	ocr_result* const res = &st->results[i];
+	pgm_image img;
+
+	pgm_map(&img, str_ptr(job->file));
+
+	region_list* const regions = split_page(&img, st->cmd->split);
+	str* const files = mem_alloc(regions->len * sizeof(str));
+
+	for(unsigned k = 0; k < regions->len; ++k)
+	{
+		if(regions->len == 1)
+			files[k] = job->file;
+		else
+		{
+			char* name = NULL;
+
+			just(asprintf(&name, "%s/page-%u.%u.pgm", job->project->tmp_dir, job->page, k + 1));
+			pgm_write_region(&img, &regions->regions[k], name);
+			files[k] = str_acquire(name);
+		}
+	}
+
+	pgm_unmap(&img);
+
+	if(regions->len > 1)
+	{
+		char name[PATH_MAX + 64];
+
+		page_name(st, job->project, job->page, name, sizeof(name));
+		info("%s: split into %zu regions", name, regions->len);
+	}
+
+	size_t k = 0;
+
+	for(; k < regions->len; ++k)
+	{
+		ocr_result r = { .tier = TIER_NONE };
+
+		recognise_file(st, job->project, files[k], job->page, lane, &r);
+
+		res->limit = r.limit;
+		res->peak_rss = (k == 0) ? r.peak_rss : max(res->peak_rss, r.peak_rss);
+		res->conf = (k == 0) ? r.conf : min(res->conf, r.conf);
+		res->tier = (k == 0) ? r.tier : max(res->tier, r.tier);
+
+		if(r.limit != TESS_OK)
+			break;
+	}
+
+	if(regions->len > 1)
+	{
+		if(k == regions->len)
+			join_texts(job->page_file, files, regions->len);
+		else
+			for(size_t n = 0; n < regions->len; ++n)
+				unlink(str_ptr(files[n]));
+
+		for(size_t n = 0; n < regions->len; ++n)
+			str_free(files[n]);
+	}
+
+	mem_free(files);
+	free_region_list(regions);
+}
+
+static
+int recognise(const ocr_state* const st, const size_t i, const unsigned lane)
+{
+	const ocr_job* const job = &st->jobs[i];
+	ocr_result* const res = &st->results[i];
+
+	if(check_blank(st, i, lane))
+		return 0;
+
+	const uint64_t start = time_msec();
+
+	if(job->split)
+		recognise_regions(st, i, lane);
+	else
+		recognise_file(st, job->project, job->file, job->page, lane, res);
+
+	res->msec = time_msec() - start;
+
+	return 0;
+}
+
+// recognise the pages of the chunk in one tesseract run, leaving out the blank ones
+static
+int recognise_chunk(const ocr_state* const st, const ocr_chunk* const c, const unsigned lane)
+{
+	const command* const cmd = st->cmd;
+	const size_t* const jobs = st->order + c->first;
+	const ocr_project* const project = st->jobs[jobs[0]].project;
+	str* const files = mem_alloc(c->len * sizeof(str));
+	unsigned first = UINT_MAX, last = 0;
+	size_t n = 0;
+
+	for(size_t k = 0; k < c->len; ++k)
+	{
+		const ocr_job* const job = &st->jobs[jobs[k]];
+
+		if(!check_blank(st, jobs[k], lane))
+		{
+			files[n++] = job->file;
+			first = min(first, job->page);
+			last = max(last, job->page);
+		}
+	}
+
+	if(n > 0)
+	{
+		// the time limits apply to the whole run
+		tess_limits lim = cmd->limits;
+
+		lim.timeout *= n;
+		lim.cpu_time *= n;
+		tess_set_limits(&lim);
+
+		char* tmp = NULL;
+
+		just(asprintf(&tmp, "%s/chunk-%d", project->tmp_dir, (int)getpid()));
+
+		const uint64_t start = time_msec(), t = trace_time();
+		const tess_status limit = tess_extract_text_list(files, n, tmp, project->tess_argv, project->tess_argc);
+		const uint64_t peak_rss = children_peak_rss();
+		const uint64_t msec = (time_msec() - start) / n;	// shared equally between the pages
+
+		trace_span_range("recognise", lane, first, last, t);
+
+		for(size_t k = 0; k < c->len; ++k)
+		{
+			ocr_result* const res = &st->results[jobs[k]];
+
+			if(res->tier != TIER_BLANK)
+			{
+				res->limit = limit;
+				res->peak_rss = peak_rss;
+				res->msec = msec;
+			}
+		}
+
+		free(tmp);
+	}
+
+	mem_free(files);
+
+	return 0;
+}
+
+// run the recognition of one page (or a page region), retrying with exponential backoff;
+// with isolate set, even the only attempt runs in its own process
+static
+int run_page(const ocr_state* const st, const size_t i, const unsigned worker, const bool isolate)
+{
+	const unsigned retries = st->cmd->retries;
+	ocr_result* const res = &st->results[i];
+
+	res->attempts = 1;
+
+	if(retries == 0 && !isolate)
+		return recognise(st, i, worker + 1);
+
+	for(;; ++res->attempts)
+	{
+		// each attempt runs in its own process, as errors terminate the process
+		just(fflush(NULL));
+
+		const pid_t pid = just(fork());
+
+		if(pid == 0)
+		{
+			const int ret = recognise(st, i, worker + 1);
+
+			just(fflush(NULL));
+			_exit(ret);
+		}
+
+		just(waitpid(pid, &res->status, 0));
+
+		if(WIFEXITED(res->status) && WEXITSTATUS(res->status) == 0)
+			return 0;
+
+		if(res->attempts > retries)
+			return WIFEXITED(res->status) ? WEXITSTATUS(res->status) : 128 + WTERMSIG(res->status);
+
+		char name[PATH_MAX + 64];
+		const unsigned delay = 1u << (res->attempts - 1);
+
+		job_name(st, &st->jobs[i], name, sizeof(name));
+		info("%s: attempt %u failed, retrying in %u s", name, res->attempts, delay);
+		sleep(delay);
+	}
+}
+
+// run the chunk in its own process; returns true if all its pages have been recognised
+static
+bool run_chunk(const ocr_state* const st, const ocr_chunk* const c, const unsigned worker)
+{
+	for(size_t k = 0; k < c->len; ++k)
+		st->results[st->order[c->first + k]].attempts = 1;
+
+	just(fflush(NULL));
+
+	const pid_t pid = just(fork());
+
+	if(pid == 0)
+	{
+		const int ret = recognise_chunk(st, c, worker + 1);
+
+		just(fflush(NULL));
+		_exit(ret);
+	}
+
+	int status;
+
+	just(waitpid(pid, &status, 0));
+
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		return false;
+
+	for(size_t k = 0; k < c->len; ++k)
+		if(st->results[st->order[c->first + k]].limit != TESS_OK)
+			return false;
+
+	return true;
+}
+
+// run the chunk, or, should it fail, each of its pages on its own, so that only the failing
+// pages are reported
+static
+int run_job(void* const ctx, const size_t n, const unsigned worker)
+{
+	const ocr_state* const st = ctx;
+	const ocr_chunk* const c = &st->chunks[n];
+	const size_t* const jobs = st->order + c->first;
+
+	trace_span("spawn", worker + 1, st->jobs[jobs[0]].page, st->spawn_time);
+
+	if(c->len == 1)
+		return run_page(st, jobs[0], worker, false);
+
+	if(run_chunk(st, c, worker))
+		return 0;
+
+	char name[PATH_MAX + 64];
+
+	job_name(st, &st->jobs[jobs[0]], name, sizeof(name));
+	info("%s and %zu more page(s): tesseract run failed, recognising them one by one", name, c->len - 1);
+
+	int ret = 0;
+
+	for(size_t k = 0; k < c->len; ++k)
+	{
+		ocr_result* const res = &st->results[jobs[k]];
+
+		*res = (ocr_result){ .single = true };
+
+		const int r = run_page(st, jobs[k], worker, true);
+
+		res->single_status = (r == 0) ? 0 : res->status;
+
+		if(ret == 0)
+			ret = r;
+	}
+
+	return ret;
+}
+
+// describe the failure of the job
+static
+void failure_reason(const ocr_result* const res, const int status, char* const buff, const size_t size)
+{
+	// prefer the status of the last attempt over that of the retrying process
+	const int s = (res->status != 0) ? res->status : status;
+
+	if(WIFSIGNALED(s))
+		snprintf(buff, size, "killed by signal %d: %s", WTERMSIG(s), strsignal(WTERMSIG(s)));
+	else
+		snprintf(buff, size, "exit code %d", WIFEXITED(s) ? WEXITSTATUS(s) : -1);
+}
+
+// report project completion
+static
+void project_done(const ocr_project* const project)
+{
+	if(project->num_failed > 0)
+		info("project \"%s\": done, pages: %u, failed: %u", project->dir, project->num_pages, project->num_failed);
+	else
+		info("project \"%s\": done, pages: %u", project->dir, project->num_pages);
+}
+
+// record the page outcome once all its regions are done
+static
+void page_done(ocr_state* const st, const size_t first)
+{
+	ocr_job* const job = &st->jobs[first];
+	ocr_project* const project = job->project;
+	const uint64_t t = trace_time();
+
+	if(job->failed)
+	{
+		journal_write(&project->journal, job->page, PAGE_FAILED, job->attempts);
+		++project->num_failed;
+		++st->num_failed;
+	}
+	else
+	{
+		if(job->region > 0)
+			join_regions(st, first);
+
+		const bool blank = (job->region == 0 && st->results[first].tier == TIER_BLANK);
+
+		journal_write(&project->journal, job->page, blank ? PAGE_BLANK : PAGE_DONE, job->attempts);
+	}
+
+	if(job->claim == CLAIM_HELD)
+	{
+		spool_release(&project->spool, job->page, job->failed);
+		job->claim = CLAIM_DONE;
+	}
+
+	trace_span("write", 0, job->page, t);
+
+	if(--project->pages_left == 0 && st->cmd->batch)
+		project_done(project);
+}
+
+// report the outcome of the job, and record the page once all its regions are done
+static
+void report_done(ocr_state* const st, const size_t i, const int status)
+{
+	const ocr_job* const job = &st->jobs[i];
+	const ocr_result* const res = &st->results[i];
+	const size_t first = (job->region > 0) ? job->first : i;
+	ocr_job* const page = &st->jobs[first];
+
+	page->attempts = max(page->attempts, res->attempts);
+
+	char name[PATH_MAX + 64];
+
+	job_name(st, job, name, sizeof(name));
+
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		char reason[100];
+
+		failure_reason(res, status, reason, sizeof(reason));
+		info("%s: failed (%s)", name, reason);
+
+		page->failed = true;
+	}
+	else if(res->limit != TESS_OK)
+	{
+		const tess_limits* const lim = &st->cmd->limits;
+
+		switch(res->limit)
+		{
+			case TESS_TIMEOUT:
+				info("%s: killed, time limit of %u s exceeded", name, lim->timeout);
+				break;
+			case TESS_CPU_LIMIT:
+				info("%s: killed, CPU time limit of %u s exceeded", name, lim->cpu_time);
+				break;
+			default:
+				info("%s: killed, memory limit of %lu MB exceeded", name, lim->max_rss >> 20);
+				break;
+		}
+
+		page->failed = true;
+	}
+	else switch(res->tier)
+	{
+		case TIER_NONE:
+			break;
+		case TIER_BLANK:
+			info("%s: blank, skipped", name);
+
+			if(job->region == 0)
+				++st->num_blank;
+
+			break;
+		case TIER_FAST:
+			info("%s: fast tier, confidence %.1f", name, res->conf);
+			++st->num_fast;
+			break;
+		case TIER_BEST:
+			if(res->conf < 0)
+				info("%s: best tier, no words recognised by fast tier", name);
+			else
+				info("%s: best tier, fast tier confidence %.1f", name, res->conf);
+
+			++st->num_best;
+			break;
+	}
+
+	if(job->region == 0 || --st->remaining[first] == 0)
+		page_done(st, first);
+}
+
+static
+void finish_job(ocr_state* const st, const size_t i, const int status)
+{
+	const ocr_job* const job = &st->jobs[i];
+	const ocr_result* const res = &st->results[i];
+
+	// the cost of the completed runs, for the estimates
+	if(WIFEXITED(status) && WEXITSTATUS(status) == 0 && res->limit == TESS_OK && res->peak_rss > 0)
+		run_stats_add(&job->project->stats, job->project->langs,
+					  (uint64_t)job->info.width * job->info.height, res->ink, res->peak_rss, res->msec);
+
+	if(!st->statuses)
+	{
+		report_done(st, i, status);
+		return;
+	}
+
+	// report the jobs in their original order, as soon as all the preceding ones are done
+	st->statuses[i] = status;
+	st->finished[i] = true;
+
+	for(; st->num_reported < st->num_jobs && st->finished[st->num_reported]; ++st->num_reported)
+	{
+		report_start(st, &st->jobs[st->num_reported]);
+		report_done(st, st->num_reported, st->statuses[st->num_reported]);
+	}
+}
+
+static
+void job_done(void* const ctx, const size_t n, const int status)
+{
+	ocr_state* const st = ctx;
+	const ocr_chunk* const c = &st->chunks[n];
+
+	st->mem_used -= st->mem_est[n];
+
+	for(size_t k = 0; k < c->len; ++k)
+	{
+		const size_t i = st->order[c->first + k];
+		const ocr_result* const res = &st->results[i];
+
+		// the pages of a failed chunk recognised on their own have their own outcome
+		finish_job(st, i, (status != 0 && res->single) ? res->single_status : status);
+	}
+}
+
+// remove the pages with any of the given statuses (as a bit mask) in the journal from
+// the list, provided that their text files exist; returns the number of pages removed
+static
+size_t skip_pages(str_list* const files, const journal* const j, const unsigned statuses)
+{
+	size_t n = 0;
+
+	for(size_t i = 0; i < files->len; ++i)
+	{
+		const str file = files->strings[i];
+		const page_status status = journal_status(j, page_no(file, str_lit("pgm")));
+		bool skip = false;
+
+		if(statuses & (1u << status))
+		{
+			char* const txt = text_name(file);
+
+			skip = (access(txt, F_OK) == 0);
+			free(txt);
+		}
+
+		if(skip)
+			str_free(file);
+		else
+			files->strings[n++] = file;
+	}
+
+	const size_t num_skipped = files->len - n;
+
+	files->len = n;
+
+	return num_skipped;
+}
+
+// read the list of projects from the batch file
+static
+ocr_project* read_batch(const command* const cmd, size_t* const pnum)
+{
+	FILE* const stream = fopen(cmd->batch, "re");
+
+	if(!stream)
+		die(errno, "cannot open file \"%s\"", cmd->batch);
+
+	ocr_project* projects = NULL;
+	size_t num = 0;
+	unsigned line_no = 0;
+	char* line = NULL;
+	size_t cap = 0;
+
+	while(getline(&line, &cap, stream) >= 0)
+	{
+		++line_no;
+
+		// the words are kept for the lifetime of the program
+		char* const s = strdup(line);
+
+		if(!s)
+			die(errno, "internal error");
+
+		unsigned n;
+		const char** const words = split_words(s, &n);
+
+		if(n == 0 || words[0][0] == '#')
+		{
+			mem_free(words);
+			free(s);
+			continue;
+		}
+
+		ocr_project project = { .dir = words[0], .tess_argv = cmd->tess_argv, .tess_argc = cmd->tess_argc };
+
+		for(unsigned k = 1; k < n; ++k)
+		{
+			if(strcmp(words[k], "--") == 0)
+			{
+				project.tess_argv = words + k + 1;
+				project.tess_argc = n - k - 1;
+				break;
+			}
+
+			if(strcmp(words[k], "-p") != 0 || k + 1 == n || project.spec)
+				die(0, "%s, line %u: unexpected argument \"%s\"", cmd->batch, line_no, words[k]);
+
+			if(!(project.spec = parse_page_spec(words[++k])))
+				die(0, "%s, line %u: empty page specification", cmd->batch, line_no);
+		}
+
+		projects = mem_realloc(projects, (num + 1) * sizeof(ocr_project));
+		projects[num++] = project;
+	}
+
+	if(ferror(stream))
+		die(errno, "error reading file \"%s\"", cmd->batch);
+
+	mem_free(line);
+	just(fclose(stream));
+
+	if(num == 0)
+		die(0, "no projects found in \"%s\"", cmd->batch);
+
+	*pnum = num;
+	return projects;
+}
+
+// order the jobs so that the projects take turns page by page
+static
+size_t* interleave_projects(const ocr_state* const st, const size_t* const first_jobs)
+{
+	size_t* const order = mem_alloc(st->num_jobs * sizeof(size_t));
+	size_t* const next = mem_alloc(st->num_projects * sizeof(size_t));
+	size_t n = 0;
+
+	memcpy(next, first_jobs, st->num_projects * sizeof(size_t));
+
+	while(n < st->num_jobs)
+	{
+		for(size_t p = 0; p < st->num_projects; ++p)
+		{
+			const size_t end = first_jobs[p + 1];
+
+			if(next[p] == end)
+				continue;
+
+			// all the regions of one page
+			do
+				order[n++] = next[p]++;
+			while(next[p] < end && st->jobs[next[p]].region > 1);
+		}
+	}
+
+	mem_free(next);
+
+	return order;
+}
+
+// estimated time of the job
+typedef struct
+{
+	double cost;
+	size_t job;
+} job_cost;
+
+static
+int cmp_costs(const void* const a, const void* const b)
+{
+	const job_cost* const x = a;
+	const job_cost* const y = b;
+
+	if(x->cost != y->cost)
+		return (x->cost < y->cost) - (x->cost > y->cost);
+
+	return (x->job > y->job) - (x->job < y->job);
+}
+
+// order the jobs by their estimated time, longest first, and report them in the original
+// order, except in worker mode
+static
+void order_longest_first(ocr_state* const st)
+{
+	job_cost* const costs = mem_alloc(st->num_jobs * sizeof(job_cost));
+
+	for(size_t i = 0; i < st->num_jobs; ++i)
+	{
+		ocr_job* const job = &st->jobs[i];
+
+		job->ink = image_ink_ratio(job->file, false);
+		costs[i] = (job_cost){
+			time_estimate(&job->project->stats, job->project->langs,
+						  (uint64_t)job->info.width * job->info.height, job->ink),
+			i
+		};
+	}
+
+	qsort(costs, st->num_jobs, sizeof(job_cost), cmp_costs);
+
+	for(size_t i = 0; i < st->num_jobs; ++i)
+		st->order[i] = costs[i].job;
+
+	mem_free(costs);
+
+	// in worker mode, most of the pages are left to the other workers
+	if(st->cmd->worker)
+		return;
+
+	st->statuses = mem_alloc(st->num_jobs * sizeof(int));
+	st->finished = mem_alloc(st->num_jobs * sizeof(bool));
+
+	memset(st->finished, 0, st->num_jobs * sizeof(bool));
+}
+
+// put the pages of the projects into the queues shared with the other workers
+static
+void open_spools(ocr_state* const st, const size_t* const first_jobs)
+{
+	unsigned* const pages = mem_alloc(max(st->num_jobs, (size_t)1) * sizeof(unsigned));
+
+	for(size_t p = 0; p < st->num_projects; ++p)
+	{
+		size_t n = 0;
+
+		for(size_t i = first_jobs[p]; i < first_jobs[p + 1]; ++i)
+			if(st->jobs[i].region <= 1)
+				pages[n++] = st->jobs[i].page;
+
+		if(n > 0 && !spool_open(&st->projects[p].spool, st->projects[p].dir, pages, n, st->cmd->lease))
+			error(0, 0, "none of the pages to recognise in \"%s\" are in its queue, which is in use"
+					  " with another page selection", st->projects[p].dir);
+	}
+
+	mem_free(pages);
+}
+
+// wait for the pages claimed by the other workers; returns true if any of our pages
+// have been given back to the queue by the workers gone, and false once all are done
+static
+bool wait_spools(ocr_state* const st)
+{
+	for(;;)
+	{
+		bool pending = false, busy = false;
+
+		for(size_t p = 0; p < st->num_projects; ++p)
+		{
+			ocr_project* const project = &st->projects[p];
+			size_t n = 0;
+
+			if(!project->spool.dir)
+				continue;
+
+			const spool_state state = spool_poll(&project->spool, &n);
+
+			pending |= (state == SPOOL_PENDING);
+			busy |= (state == SPOOL_BUSY);
+
+			if(n > 0 && st->cmd->batch)
+				info("project \"%s\": %zu page(s) of the workers gone put back into the queue", project->dir, n);
+			else if(n > 0)
+				info("%zu page(s) of the workers gone put back into the queue", n);
+		}
+
+		if(pending || !busy)
+			return pending;
+
+		sleep(max(st->cmd->lease / 4, 1u));
+	}
+}
+
+// split the order into chunks of whole pages of the same project, each recognised in one
+// tesseract run; the chunks are small enough to give each worker several of them, so that
+// the workers finish at about the same time
+static
+void make_chunks(ocr_state* const st)
+{
+	const command* const cmd = st->cmd;
+	const size_t size = min(max(st->num_jobs / (4 * (size_t)cmd->jobs), (size_t)1), (size_t)cmd->chunk);
+	size_t* const chunk_of = mem_alloc(st->num_jobs * sizeof(size_t));		// per position in the order
+	size_t* const last = mem_alloc(st->num_projects * sizeof(size_t));	// open chunk of the project
+
+	st->chunks = mem_alloc(st->num_jobs * sizeof(ocr_chunk));
+	st->num_chunks = 0;
+
+	for(size_t p = 0; p < st->num_projects; ++p)
+		last[p] = SIZE_MAX;
+
+	// assign the jobs to the chunks, in the order
+	for(size_t n = 0; n < st->num_jobs; ++n)
+	{
+		ocr_job* const job = &st->jobs[st->order[n]];
+		const size_t p = job->project - st->projects;
+		size_t c = last[p];
+
+		// page regions, and pages to split, are recognised one by one
+		if(job->region > 0 || job->split || c == SIZE_MAX || st->chunks[c].len == size)
+		{
+			c = st->num_chunks++;
+			st->chunks[c] = (ocr_chunk){ .len = 0 };
+
+			if(job->region == 0 && !job->split)
+				last[p] = c;
+		}
+
+		if(++st->chunks[c].len == 2)
+			get_tmp_dir(job->project);
+
+		chunk_of[n] = c;
+	}
+
+	// lay the chunks out one after another
+	size_t* const order = mem_alloc(st->num_jobs * sizeof(size_t));
+
+	for(size_t c = 0, first = 0; c < st->num_chunks; ++c)
+	{
+		st->chunks[c].first = first;
+		st->chunks[c].size = st->chunks[c].len;
+		first += st->chunks[c].len;
+		st->chunks[c].len = 0;
+	}
+
+	for(size_t n = 0; n < st->num_jobs; ++n)
+	{
+		ocr_chunk* const c = &st->chunks[chunk_of[n]];
+
+		order[c->first + c->len++] = st->order[n];
+	}
+
+	mem_free(st->order);
+	st->order = order;
+
+	mem_free(last);
+	mem_free(chunk_of);
+}
+
+int main(int argc, char* argv[])
+{
+	// command line options
+	command cmd;
+
+	parse_options(&cmd, argc, argv);
+
+	// make sure stdin is closed on exec
+	just(fcntl(STDIN_FILENO, F_SETFD, fcntl(STDIN_FILENO, F_GETFD) | FD_CLOEXEC));
+
+	// check if tesseract is installed
+	tess_check();
+
+	// projects
+	ocr_state st = { .cmd = &cmd };
+
+	if(cmd.batch)
+		st.projects = read_batch(&cmd, &st.num_projects);
+	else
+	{
+		st.projects = mem_alloc(sizeof(ocr_project));
+		st.projects[0] = (ocr_project){
+			.dir = cmd.dir,
+			.spec = cmd.spec,
+			.tess_argv = cmd.tess_argv,
+			.tess_argc = cmd.tess_argc
+		};
+
+		st.num_projects = 1;
+	}
+
+	// check language spec
+	check_tess_lang_opt(cmd.tess_argv, cmd.tess_argc);
+
+	for(size_t p = 0; p < st.num_projects; ++p)
+		if(st.projects[p].tess_argv != cmd.tess_argv)
+			check_tess_lang_opt(st.projects[p].tess_argv, st.projects[p].tess_argc);
+
+	if(cmd.fast_argv)
+		check_tess_lang_opt(cmd.fast_argv, cmd.fast_argc);
+
+	// get file lists
+	size_t num_files = 0;
+
+	for(size_t p = 0; p < st.num_projects; ++p)
+	{
+		ocr_project* const project = &st.projects[p];
+
+		project->files = list_files(project->dir, project->spec, "pgm");
+		num_files += str_list_len(project->files);
+	}
+
+	if(num_files == 0)
+	{
+		if(cmd.fail_on_empty)
+			error(2, 0, "no pages found");
+
+		return 0;
+	}
+
+	// use one thread per tesseract process when running in parallel
+	if(cmd.jobs > 1)
+		just(setenv("OMP_THREAD_LIMIT", "1", 0));
+
+	tess_set_limits(&cmd.limits);
+
+	if(cmd.trace)
+		trace_open(cmd.trace, cmd.jobs);
+
+	// journals
+	for(size_t p = 0; p < st.num_projects; ++p)
+	{
+		ocr_project* const project = &st.projects[p];
+
+		journal_open(&project->journal, project->dir);
+		run_stats_open(&project->stats, project->dir);
+
+		// both tiers run in the same job
+		if(cmd.fast_argv)
+			just(asprintf(&project->langs, "%s/%s", tess_lang_set(cmd.fast_argv, cmd.fast_argc),
+						  tess_lang_set(project->tess_argv, project->tess_argc)));
+		else
+			project->langs = strdup(tess_lang_set(project->tess_argv, project->tess_argc));
+
+		if(!cmd.force_ocr && !str_list_is_empty(project->files))
+		{
+			const size_t n = skip_pages(project->files, &project->journal, 1u << PAGE_TEXT);
+
+			if(n > 0 && cmd.batch)
+				info("project \"%s\": skipping %zu page(s) with text from the text layer", project->dir, n);
+			else if(n > 0)
+				info("skipping %zu page(s) with text from the text layer", n);
+		}
+
+		if(cmd.resume && !str_list_is_empty(project->files))
+		{
+			const size_t total = project->files->len;
+
+			skip_pages(project->files, &project->journal, (1u << PAGE_DONE) | (1u << PAGE_BLANK));
+
+			if(cmd.batch)
+				info("project \"%s\": resuming: %zu of %zu pages already done",
+					 project->dir, total - project->files->len, total);
+			else
+				info("resuming: %zu of %zu pages already done", total - project->files->len, total);
+		}
+	}
+
+	// validate images
+	const pgm_info** const meta = mem_alloc(st.num_projects * sizeof(pgm_info*));
+
+	for(size_t p = 0; p < st.num_projects; ++p)
+		meta[p] = str_list_is_empty(st.projects[p].files) ? NULL : pgm_check_files(st.projects[p].files);
+
+	// prepare jobs
+	size_t* const first_jobs = mem_alloc((st.num_projects + 1) * sizeof(size_t));
+
+	for(size_t p = 0; p < st.num_projects; ++p)
+	{
+		ocr_project* const project = &st.projects[p];
+		const size_t len = str_list_len(project->files);
+
+		first_jobs[p] = st.num_jobs;
+		project->num_pages = len;
+
+		for(size_t i = 0; i < len; ++i)
+			project->pages_left += add_page_jobs(&st, project, project->files->strings[i], &meta[p][i]);
+
+		if(project->pages_left == 0 && cmd.batch)
+			project_done(project);
+	}
+
+	first_jobs[st.num_projects] = st.num_jobs;
+
+	// run OCR
+	if(st.num_jobs > 0)
+	{
+		st.order = interleave_projects(&st, first_jobs);
+
+		if(cmd.longest_first)
+			order_longest_first(&st);
+
+		make_chunks(&st);
+
+		if(cmd.worker)
+			open_spools(&st, first_jobs);
+
+		st.results = shared_alloc(st.num_jobs * sizeof(ocr_result));
+		st.remaining = mem_alloc(st.num_jobs * sizeof(unsigned));
+		st.mem_est = mem_alloc(st.num_chunks * sizeof(uint64_t));
+
+		for(size_t i = 0; i < st.num_jobs; ++i)
+			st.remaining[i] = st.jobs[i].num_regions;
+
+		const job_runner runner =
+		{
+			.start = start_job,
+			.run = run_job,
+			.done = job_done,
+			.admit = cmd.mem_budget > 0 ? admit_job : NULL,
+			.claim = cmd.worker ? claim_job : NULL,
+			.ctx = &st,
+			.keep_going = cmd.keep_going
+		};
+
+		int status = run_jobs(&runner, st.num_chunks, cmd.jobs);
+
+		// in worker mode, run again over the pages of the workers gone
+		while(cmd.worker && (status == 0 || cmd.keep_going) && wait_spools(&st))
+		{
+			const int s = run_jobs(&runner, st.num_chunks, cmd.jobs);
+
+			if(status == 0)
+				status = s;
+		}
+
+		// the jobs done after a job that has not been started
+		if(st.statuses)
+			for(size_t i = st.num_reported; i < st.num_jobs; ++i)
+			{
+				if(st.finished[i])
+				{
+					report_start(&st, &st.jobs[i]);
+					report_done(&st, i, st.statuses[i]);
+				}
+			}
+
+		if(status != 0 && !cmd.keep_going)
+			check_exit_status(status);
+	}
+
+	for(size_t p = 0; p < st.num_projects; ++p)
+	{
+		journal_close(&st.projects[p].journal);
+		spool_close(&st.projects[p].spool);
+		run_stats_close(&st.projects[p].stats);
+		free(st.projects[p].langs);
+	}
+
+	if(cmd.blank > 0)
+		info("blank pages skipped: %u", st.num_blank);
+
+	if(cmd.fast_argv)
+		info("recognised by fast tier: %u, by best tier: %u", st.num_fast, st.num_best);
+
+	if(st.num_failed > 0)
+		die(0, "failed pages: %u of %zu (run with -R option to retry them)", st.num_failed, num_files);
+
 	return 0;
 }
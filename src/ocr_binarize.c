@@ -0,0 +1,260 @@
+#include "list_pages.h"
+#include "pgm.h"
+#include "binarize.h"
+#include "jobs.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/wait.h>
+
+#define info(fmt, ...) just(printf("%s: " fmt "\n", program_invocation_name, ##__VA_ARGS__))
+
+static const char usage_string[] =
+	"Usage:\t" PROG_NAME " [OPTION]...\n\n"
+	"Convert the page images from the specified range of pages to bilevel images, so that\n"
+	"tesseract can use them directly, without thresholding them on every run. The images\n"
+	"are replaced in place with images in PBM format.\n\n"
+	"Options:\n"
+	"  -p,--pages=SPEC\n"
+	"         Pages to process. A page specification contains one or more comma-separated page\n"
+	"         ranges. A page range is either a page number, or two page numbers separated by\n"
+	"         a dash. In the last range, the second page number may be omitted, meaning all\n"
+	"         the remaining pages of the document. For instance, specification \"1-10\" outputs\n"
+	"         pages 1 to 10, and specification \"1,3,5-\" outputs pages 1 and 3, followed by\n"
+	"         all the pages starting from page 5 to the end of the document.\n"
+	"         (optional, default: all pages)\n\n"
+	"  -d,--dir=DIR\n"
+	"         Input directory (optional, default: .)\n\n"
+	"  -m,--method=METHOD\n"
+	"         Thresholding method, either \"otsu\" (global threshold), or \"sauvola\" (local\n"
+	"         threshold, better for uneven lighting and stains).\n"
+	"         (optional, default: sauvola)\n\n"
+	"  -w,--window=N\n"
+	"         Window size in pixels for \"sauvola\" method, an odd number from 3 to 1001.\n"
+	"         (optional, default: 51)\n\n"
+	"  -k,--sensitivity=K\n"
+	"         Sensitivity for \"sauvola\" method, from 0.01 to 1; higher values produce\n"
+	"         thinner strokes.\n"
+	"         (optional, default: 0.34)\n\n"
+	"  -j,--jobs=N\n"
+	"         Number of pages to process in parallel.\n"
+	"         (optional, default: 1)\n\n"
+	"  -f,--fail-on-empty\n"
+	"         Fail if no files found.\n\n"
+	"  -h,--help\n"
+	"         Show help and exit.\n\n"
+	"  -v,--version\n"
+	"         Show version and exit.\n";
+
+// command line parameters
+typedef struct
+{
+	const char* dir;
+	page_spec* spec;
+	bool otsu;
+	unsigned window;
+	double k;
+	unsigned jobs;
+	bool fail_on_empty;
+} command;
+
+static
+double parse_double(const char* const arg, const char* const opt, const double from, const double to)
+{
+	char* end;
+
+	errno = 0;
+
+	const double val = strtod(arg, &end);
+
+	if(end == arg || *end != 0 || errno != 0 || !isfinite(val))
+		die(0, "invalid argument for %s option: \"%s\"", opt, arg);
+
+	if(val < from || val > to)
+		die(0, "argument for %s option is out of range: \"%s\"", opt, arg);
+
+	return val;
+}
+
+// option parser
+static
+void parse_options(command* const cmd, int argc, char* argv[])
+{
+	// options specification
+	static
+	const struct option long_options[] =
+	{
+		{"pages",  required_argument, NULL, 'p'},
+		{"dir",  required_argument, NULL, 'd'},
+		{"method",  required_argument, NULL, 'm'},
+		{"window",  required_argument, NULL, 'w'},
+		{"sensitivity",  required_argument, NULL, 'k'},
+		{"jobs",  required_argument, NULL, 'j'},
+		{"fail-on-empty",  no_argument, NULL, 'f'},
+		{"help",  no_argument, NULL, 'h'},
+		{"version",  no_argument, NULL, 'v'},
+		{NULL, 0, NULL, 0}
+	};
+
+	// prepare target
+	*cmd = (command){ .dir = ".", .window = 51, .k = 0.34, .jobs = 1 };
+
+	// parser loop
+	int opt, option_index = 0;
+
+	while((opt = getopt_long(argc, argv, "+p:d:m:w:k:j:fhv", long_options, &option_index)) >= 0)
+	{
+		switch(opt)
+		{
+			case 'p':
+				if(cmd->spec)
+					free((void*)cmd->spec);
+
+				if(!(cmd->spec = parse_page_spec(optarg)))
+					die(0, "empty parameter specified for -p,--pages option");
+
+				break;
+			case 'd':
+				if(*optarg == 0)
+					die(0, "empty directory name");
+
+				cmd->dir = optarg;
+				break;
+			case 'm':
+				if(strcmp(optarg, "otsu") == 0)
+					cmd->otsu = true;
+				else if(strcmp(optarg, "sauvola") == 0)
+					cmd->otsu = false;
+				else
+					die(0, "invalid argument for -m,--method option: \"%s\"", optarg);
+
+				break;
+			case 'w':
+			{
+				char* end;
+				const unsigned long n = strtoul(optarg, &end, 10);
+
+				if(end == optarg || *end != 0 || n < 3 || n > 1001 || n % 2 == 0)
+					die(0, "invalid argument for -w,--window option: \"%s\"", optarg);
+
+				cmd->window = n;
+				break;
+			}
+			case 'k':
+				cmd->k = parse_double(optarg, "-k,--sensitivity", 0.01, 1);
+				break;
+			case 'j':
+				cmd->jobs = parse_num_jobs(optarg);
+				break;
+			case 'f':
+				cmd->fail_on_empty = true;
+				break;
+			case 'h':
+				show_usage_and_exit(usage_string);
+				break;
+			case 'v':
+				show_version_and_exit();
+				break;
+			case '?':
+				exit(1);
+			default:
+				die(0, "internal error (getopt_long(3) returned %d)", opt);
+		}
+	}
+
+	if(argc > optind)
+		die(0, "unexpected argument: \"%s\"", argv[optind]);
+}
+
+// processing state
+typedef struct
+{
+	const command* cmd;
+	const str_list* files;
+	unsigned* thresholds;	// shared with child processes
+} binarize_state;
+
+static
+int run_job(void* const ctx, const size_t i, const unsigned UNUSED(worker))
+{
+	const binarize_state* const st = ctx;
+	const char* const name = str_ptr(st->files->strings[i]);
+
+	image img;
+
+	image_load(&img, name);
+
+	if(!img.bilevel)
+	{
+		if(st->cmd->otsu)
+			st->thresholds[i] = binarize_otsu(&img);
+		else
+			binarize_sauvola(&img, st->cmd->window, st->cmd->k);
+
+		image_save(&img, name);
+	}
+
+	image_free(&img);
+
+	return 0;
+}
+
+static
+void job_done(void* const ctx, const size_t i, const int status)
+{
+	const binarize_state* const st = ctx;
+
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		return;
+
+	const unsigned page = page_no(st->files->strings[i], str_lit("pgm"));
+
+	if(st->cmd->otsu)
+		info("page %u: done, threshold %u", page, st->thresholds[i]);
+	else
+		info("page %u: done", page);
+}
+
+int main(int argc, char* argv[])
+{
+	// command line options
+	command cmd;
+
+	parse_options(&cmd, argc, argv);
+
+	// make sure stdin is closed on exec
+	just(fcntl(STDIN_FILENO, F_SETFD, fcntl(STDIN_FILENO, F_GETFD) | FD_CLOEXEC));
+
+	// get file list
+	str_list* const files = list_files(cmd.dir, cmd.spec, "pgm");
+
+	if(str_list_is_empty(files))
+	{
+		if(cmd.fail_on_empty)
+			error(2, 0, "no pages found");
+
+		return 0;
+	}
+
+	// validate images
+	mem_free(pgm_check_files(files));
+
+	// process pages
+	binarize_state st =
+	{
+		.cmd = &cmd,
+		.files = files,
+		.thresholds = shared_alloc(files->len * sizeof(unsigned))
+	};
+
+	const job_runner runner = { .run = run_job, .done = job_done, .ctx = &st };
+	const int status = run_jobs(&runner, files->len, cmd.jobs);
+
+	if(status != 0)
+		check_exit_status(status);
+
+	return 0;
+}
@@ -0,0 +1,443 @@
+#include "list_pages.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+static const char usage_string[] =
+	"Usage:\t" PROG_NAME " [OPTION]...\n"
+	"  or:\t" PROG_NAME " -i FILE -l OFFSET\n\n"
+	"Concatenate the recognised text of the specified range of pages, in page order.\n"
+	"Optionally, write the index mapping byte offsets in the output to page numbers,\n"
+	"or look up the page at the given offset in such an index.\n\n"
+	"Options:\n"
+	"  -p,--pages=SPEC\n"
+	"         Pages to process. A page specification contains one or more comma-separated page\n"
+	"         ranges. A page range is either a page number, or two page numbers separated by\n"
+	"         a dash. In the last range, the second page number may be omitted, meaning all\n"
+	"         the remaining pages of the document. For instance, specification \"1-10\" outputs\n"
+	"         pages 1 to 10, and specification \"1,3,5-\" outputs pages 1 and 3, followed by\n"
+	"         all the pages starting from page 5 to the end of the document.\n"
+	"         (optional, default: all pages)\n\n"
+	"  -d,--dir=DIR\n"
+	"         Input directory (optional, default: .)\n\n"
+	"  -o,--output=FILE\n"
+	"         Output file (optional, default: standard output)\n\n"
+	"  -m,--marker=TEXT\n"
+	"         Insert a line with the given text before the text of each page; \"{page}\" in\n"
+	"         the text is replaced with the page number, for example \"--- page {page} ---\".\n"
+	"         (optional, default: no markers)\n\n"
+	"  -i,--index=FILE\n"
+	"         Index file to write, or to read with -l option. The index is a binary file\n"
+	"         starting with the 8-byte signature \"OCRIDX2\\n\", followed by one 12-byte record\n"
+	"         per page, in page order: the offset of the page text (including its marker)\n"
+	"         in the output, as 64-bit little-endian number, and the page number, as 32-bit\n"
+	"         little-endian number. The last record has page number 0 and the length of the\n"
+	"         output as the offset.\n\n"
+	"  -l,--lookup=OFFSET\n"
+	"         Print the number of the page containing the given byte offset, using the index\n"
+	"         given by -i option.\n\n"
+	"  -f,--fail-on-empty\n"
+	"         Fail if no files found.\n\n"
+	"  -h,--help\n"
+	"         Show help and exit.\n\n"
+	"  -v,--version\n"
+	"         Show version and exit.\n";
+
+// index format
+#define INDEX_SIGNATURE		"OCRIDX2\n"
+#define INDEX_SIG_SIZE		(sizeof(INDEX_SIGNATURE) - 1)
+#define INDEX_RECORD_SIZE	12
+
+// command line parameters
+typedef struct
+{
+	const char *dir, *output, *marker, *index, *lookup;
+	page_spec* spec;
+	bool fail_on_empty;
+} command;
+
+// option parser
+static
+void parse_options(command* const cmd, int argc, char* argv[])
+{
+	// options specification
+	static
+	const struct option long_options[] =
+	{
+		{"pages",  required_argument, NULL, 'p'},
+		{"dir",  required_argument, NULL, 'd'},
+		{"output",  required_argument, NULL, 'o'},
+		{"marker",  required_argument, NULL, 'm'},
+		{"index",  required_argument, NULL, 'i'},
+		{"lookup",  required_argument, NULL, 'l'},
+		{"fail-on-empty",  no_argument, NULL, 'f'},
+		{"help",  no_argument, NULL, 'h'},
+		{"version",  no_argument, NULL, 'v'},
+		{NULL, 0, NULL, 0}
+	};
+
+	// prepare target
+	*cmd = (command){ .dir = "." };
+
+	// parser loop
+	int opt, option_index = 0;
+
+	while((opt = getopt_long(argc, argv, "+p:d:o:m:i:l:fhv", long_options, &option_index)) >= 0)
+	{
+		switch(opt)
+		{
+			case 'p':
+				if(cmd->spec)
+					free((void*)cmd->spec);
+
+				if(!(cmd->spec = parse_page_spec(optarg)))
+					die(0, "empty parameter specified for -p,--pages option");
+
+				break;
+			case 'd':
+				if(*optarg == 0)
+					die(0, "empty directory name");
+
+				cmd->dir = optarg;
+				break;
+			case 'o':
+				if(*optarg == 0)
+					die(0, "empty file name specified for -o,--output option");
+
+				cmd->output = optarg;
+				break;
+			case 'm':
+				cmd->marker = optarg;
+				break;
+			case 'i':
+				if(*optarg == 0)
+					die(0, "empty file name specified for -i,--index option");
+
+				cmd->index = optarg;
+				break;
+			case 'l':
+				cmd->lookup = optarg;
+				break;
+			case 'f':
+				cmd->fail_on_empty = true;
+				break;
+			case 'h':
+				show_usage_and_exit(usage_string);
+				break;
+			case 'v':
+				show_version_and_exit();
+				break;
+			case '?':
+				exit(1);
+			default:
+				die(0, "internal error (getopt_long(3) returned %d)", opt);
+		}
+	}
+
+	if(argc > optind)
+		die(0, "unexpected argument: \"%s\"", argv[optind]);
+
+	if(cmd->lookup && !cmd->index)
+		die(0, "option -l,--lookup requires -i,--index option");
+}
+
+// output writer
+typedef struct
+{
+	int fd;
+	const char* name;
+	uint64_t offset;		// number of bytes written so far
+	bool copy_range, send;	// kernel copy methods not yet found unsupported
+} writer;
+
+static
+void write_all(writer* const w, const void* const buff, const size_t len)
+{
+	for(size_t n = 0; n < len; )
+	{
+		const ssize_t ret = write(w->fd, (const char*)buff + n, len - n);
+
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+				continue;
+
+			die(errno, "error writing \"%s\"", w->name);
+		}
+
+		n += ret;
+	}
+
+	w->offset += len;
+}
+
+// copy the whole file to the output, in the kernel where possible
+static
+void copy_file(writer* const w, const char* const name)
+{
+	const int fd = open(name, O_RDONLY | O_CLOEXEC);
+
+	if(fd < 0)
+		die(errno, "cannot open file \"%s\"", name);
+
+	struct stat info;
+
+	just(fstat(fd, &info));
+
+	size_t left = info.st_size;
+
+	// copy_file_range(2) works between regular files only
+	while(left > 0 && w->copy_range)
+	{
+		const ssize_t n = copy_file_range(fd, NULL, w->fd, NULL, left, 0);
+
+		if(n > 0)
+		{
+			left -= n;
+			w->offset += n;
+		}
+		else if(n == 0)
+			break;	// the file has been truncated
+		else if(errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF)
+			w->copy_range = false;
+		else if(errno != EINTR)
+			die(errno, "error copying \"%s\" to \"%s\"", name, w->name);
+	}
+
+	// sendfile(2) works with any output
+	while(left > 0 && w->send)
+	{
+		const ssize_t n = sendfile(w->fd, fd, NULL, left);
+
+		if(n > 0)
+		{
+			left -= n;
+			w->offset += n;
+		}
+		else if(n == 0)
+			break;
+		else if(errno == EINVAL || errno == ENOSYS)
+			w->send = false;
+		else if(errno != EINTR)
+			die(errno, "error copying \"%s\" to \"%s\"", name, w->name);
+	}
+
+	// plain copy
+	char buff[64 * 1024];
+
+	while(left > 0)
+	{
+		const ssize_t n = read(fd, buff, min(left, sizeof(buff)));
+
+		if(n < 0)
+		{
+			if(errno == EINTR)
+				continue;
+
+			die(errno, "error reading file \"%s\"", name);
+		}
+
+		if(n == 0)
+			break;
+
+		write_all(w, buff, n);
+		left -= n;
+	}
+
+	just(close(fd));
+}
+
+// write the page marker
+static
+void write_marker(writer* const w, const char* s, const unsigned page)
+{
+	char* res = NULL;
+	size_t size = 0;
+	FILE* const out = just(open_memstream(&res, &size));
+
+	while(*s)
+	{
+		if(strncmp(s, "{page}", 6) == 0)
+		{
+			just(fprintf(out, "%u", page));
+			s += 6;
+		}
+		else
+			just(fputc(*s++, out));
+	}
+
+	just(fputc('\n', out));
+	just(fclose(out));
+
+	write_all(w, res, size);
+	free(res);
+}
+
+// index record
+static
+void write_record(FILE* const index, const char* const name, const uint64_t offset, const unsigned page)
+{
+	unsigned char rec[INDEX_RECORD_SIZE];
+	const uint64_t off = htole64(offset);
+	const uint32_t pg = htole32(page);
+
+	memcpy(rec, &off, sizeof(off));
+	memcpy(rec + sizeof(off), &pg, sizeof(pg));
+
+	if(fwrite(rec, sizeof(rec), 1, index) != 1)
+		die(errno, "error writing file \"%s\"", name);
+}
+
+static
+int concatenate(const command* const cmd)
+{
+	str_list* const files = list_files(cmd->dir, cmd->spec, "txt");
+
+	if(str_list_is_empty(files) && cmd->fail_on_empty)
+		error(2, 0, "no pages found");
+
+	// output
+	writer w = { .fd = STDOUT_FILENO, .name = "standard output", .copy_range = true, .send = true };
+
+	if(cmd->output)
+	{
+		if((w.fd = open(cmd->output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+			die(errno, "cannot create file \"%s\"", cmd->output);
+
+		w.name = cmd->output;
+	}
+
+	// index
+	FILE* index = NULL;
+
+	if(cmd->index)
+	{
+		if(!(index = fopen(cmd->index, "we")))
+			die(errno, "cannot create file \"%s\"", cmd->index);
+
+		if(fwrite(INDEX_SIGNATURE, INDEX_SIG_SIZE, 1, index) != 1)
+			die(errno, "error writing file \"%s\"", cmd->index);
+	}
+
+	// pages
+	for(size_t i = 0; i < str_list_len(files); ++i)
+	{
+		const str file = files->strings[i];
+		const unsigned page = page_no(file, str_lit("txt"));
+
+		if(index)
+			write_record(index, cmd->index, w.offset, page);
+
+		if(cmd->marker)
+			write_marker(&w, cmd->marker, page);
+
+		copy_file(&w, str_ptr(file));
+	}
+
+	// end of the output
+	if(index)
+		write_record(index, cmd->index, w.offset, 0);
+
+	if(index && fclose(index) != 0)
+		die(errno, "error writing file \"%s\"", cmd->index);
+
+	if(cmd->output && close(w.fd) != 0)
+		die(errno, "error writing file \"%s\"", cmd->output);
+
+	str_list_free(files);
+
+	return 0;
+}
+
+// find the page at the given offset: the last record with the offset not above it
+static
+int lookup(const command* const cmd)
+{
+	char* end;
+
+	errno = 0;
+
+	const unsigned long long offset = strtoull(cmd->lookup, &end, 10);
+
+	if(end == cmd->lookup || *end != 0 || errno != 0 || *cmd->lookup == '-')
+		die(0, "invalid argument for -l,--lookup option: \"%s\"", cmd->lookup);
+
+	const int fd = open(cmd->index, O_RDONLY | O_CLOEXEC);
+
+	if(fd < 0)
+		die(errno, "cannot open file \"%s\"", cmd->index);
+
+	struct stat info;
+
+	just(fstat(fd, &info));
+
+	const size_t size = info.st_size;
+
+	if(size < INDEX_SIG_SIZE + INDEX_RECORD_SIZE || (size - INDEX_SIG_SIZE) % INDEX_RECORD_SIZE != 0)
+		die(0, "invalid index file \"%s\"", cmd->index);
+
+	const unsigned char* const map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if(map == MAP_FAILED)
+		die(errno, "cannot map file \"%s\"", cmd->index);
+
+	just(close(fd));
+
+	if(memcmp(map, INDEX_SIGNATURE, INDEX_SIG_SIZE) != 0)
+		die(0, "invalid index file \"%s\"", cmd->index);
+
+	const unsigned char* const records = map + INDEX_SIG_SIZE;
+	const size_t num_records = (size - INDEX_SIG_SIZE) / INDEX_RECORD_SIZE;
+	size_t lo = 0, hi = num_records;
+
+	// binary search for the first record with the offset above the given one
+	while(lo < hi)
+	{
+		const size_t mid = lo + (hi - lo) / 2;
+		uint64_t off;
+
+		memcpy(&off, records + mid * INDEX_RECORD_SIZE, sizeof(off));
+
+		if(le64toh(off) <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	// the last record marks the end of the output
+	if(lo == 0 || lo == num_records)
+		die(0, "offset %llu is not in the index", offset);
+
+	uint32_t page;
+
+	memcpy(&page, records + (lo - 1) * INDEX_RECORD_SIZE + sizeof(uint64_t), sizeof(page));
+
+	if(page == 0)
+		die(0, "invalid index file \"%s\"", cmd->index);
+
+	just(printf("%u\n", le32toh(page)));
+
+	munmap((void*)map, size);
+
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	// command line options
+	command cmd;
+
+	parse_options(&cmd, argc, argv);
+
+	// make sure stdin is closed on exec
+	just(fcntl(STDIN_FILENO, F_SETFD, fcntl(STDIN_FILENO, F_GETFD) | FD_CLOEXEC));
+
+	return cmd.lookup ? lookup(&cmd) : concatenate(&cmd);
+}
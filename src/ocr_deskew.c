@@ -0,0 +1,235 @@
+#include "list_pages.h"
+#include "pgm.h"
+#include "deskew.h"
+#include "jobs.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/wait.h>
+
+#define info(fmt, ...) just(printf("%s: " fmt "\n", program_invocation_name, ##__VA_ARGS__))
+
+static const char usage_string[] =
+	"Usage:\t" PROG_NAME " [OPTION]...\n\n"
+	"Correct the skew of the page images from the specified range of pages. The images\n"
+	"are modified in place.\n\n"
+	"Options:\n"
+	"  -p,--pages=SPEC\n"
+	"         Pages to process. A page specification contains one or more comma-separated page\n"
+	"         ranges. A page range is either a page number, or two page numbers separated by\n"
+	"         a dash. In the last range, the second page number may be omitted, meaning all\n"
+	"         the remaining pages of the document. For instance, specification \"1-10\" outputs\n"
+	"         pages 1 to 10, and specification \"1,3,5-\" outputs pages 1 and 3, followed by\n"
+	"         all the pages starting from page 5 to the end of the document.\n"
+	"         (optional, default: all pages)\n\n"
+	"  -d,--dir=DIR\n"
+	"         Input directory (optional, default: .)\n\n"
+	"  -a,--min-angle=DEG\n"
+	"         Leave pages skewed by less than DEG degrees unchanged.\n"
+	"         (optional, default: 0.1)\n\n"
+	"  -m,--max-angle=DEG\n"
+	"         Maximum skew angle to detect, from 0.5 to 15 degrees.\n"
+	"         (optional, default: 5)\n\n"
+	"  -j,--jobs=N\n"
+	"         Number of pages to process in parallel.\n"
+	"         (optional, default: 1)\n\n"
+	"  -f,--fail-on-empty\n"
+	"         Fail if no files found.\n\n"
+	"  -h,--help\n"
+	"         Show help and exit.\n\n"
+	"  -v,--version\n"
+	"         Show version and exit.\n";
+
+// command line parameters
+typedef struct
+{
+	const char* dir;
+	page_spec* spec;
+	double min_angle, max_angle;
+	unsigned jobs;
+	bool fail_on_empty;
+} command;
+
+static
+double parse_angle(const char* const arg, const char* const opt, const double from, const double to)
+{
+	char* end;
+
+	errno = 0;
+
+	const double val = strtod(arg, &end);
+
+	if(end == arg || *end != 0 || errno != 0 || !isfinite(val))
+		die(0, "invalid argument for %s option: \"%s\"", opt, arg);
+
+	if(val < from || val > to)
+		die(0, "argument for %s option is out of range: \"%s\"", opt, arg);
+
+	return val;
+}
+
+// option parser
+static
+void parse_options(command* const cmd, int argc, char* argv[])
+{
+	// options specification
+	static
+	const struct option long_options[] =
+	{
+		{"pages",  required_argument, NULL, 'p'},
+		{"dir",  required_argument, NULL, 'd'},
+		{"min-angle",  required_argument, NULL, 'a'},
+		{"max-angle",  required_argument, NULL, 'm'},
+		{"jobs",  required_argument, NULL, 'j'},
+		{"fail-on-empty",  no_argument, NULL, 'f'},
+		{"help",  no_argument, NULL, 'h'},
+		{"version",  no_argument, NULL, 'v'},
+		{NULL, 0, NULL, 0}
+	};
+
+	// prepare target
+	*cmd = (command){ .dir = ".", .min_angle = 0.1, .max_angle = 5, .jobs = 1 };
+
+	// parser loop
+	int opt, option_index = 0;
+
+	while((opt = getopt_long(argc, argv, "+p:d:a:m:j:fhv", long_options, &option_index)) >= 0)
+	{
+		switch(opt)
+		{
+			case 'p':
+				if(cmd->spec)
+					free((void*)cmd->spec);
+
+				if(!(cmd->spec = parse_page_spec(optarg)))
+					die(0, "empty parameter specified for -p,--pages option");
+
+				break;
+			case 'd':
+				if(*optarg == 0)
+					die(0, "empty directory name");
+
+				cmd->dir = optarg;
+				break;
+			case 'a':
+				cmd->min_angle = parse_angle(optarg, "-a,--min-angle", 0, 15);
+				break;
+			case 'm':
+				cmd->max_angle = parse_angle(optarg, "-m,--max-angle", 0.5, 15);
+				break;
+			case 'j':
+				cmd->jobs = parse_num_jobs(optarg);
+				break;
+			case 'f':
+				cmd->fail_on_empty = true;
+				break;
+			case 'h':
+				show_usage_and_exit(usage_string);
+				break;
+			case 'v':
+				show_version_and_exit();
+				break;
+			case '?':
+				exit(1);
+			default:
+				die(0, "internal error (getopt_long(3) returned %d)", opt);
+		}
+	}
+
+	if(argc > optind)
+		die(0, "unexpected argument: \"%s\"", argv[optind]);
+}
+
+// processing state
+typedef struct
+{
+	const command* cmd;
+	const str_list* files;
+	double* angles;		// shared with child processes
+} deskew_state;
+
+static
+int run_job(void* const ctx, const size_t i, const unsigned UNUSED(worker))
+{
+	const deskew_state* const st = ctx;
+	const char* const name = str_ptr(st->files->strings[i]);
+
+	image img;
+
+	image_load(&img, name);
+
+	const double angle = skew_angle(&img, st->cmd->max_angle);
+
+	if(fabs(angle) >= st->cmd->min_angle)
+	{
+		image_rotate(&img, -angle);
+		image_save(&img, name);
+	}
+
+	st->angles[i] = angle;
+	image_free(&img);
+
+	return 0;
+}
+
+static
+void job_done(void* const ctx, const size_t i, const int status)
+{
+	const deskew_state* const st = ctx;
+
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		return;
+
+	const str file = st->files->strings[i];
+	const unsigned page = page_no(file, str_lit("pgm"));
+	const double angle = st->angles[i];
+
+	if(fabs(angle) >= st->cmd->min_angle)
+		info("page %u: skew %.2f degrees, corrected", page, angle);
+	else
+		info("page %u: skew %.2f degrees, unchanged", page, angle);
+}
+
+int main(int argc, char* argv[])
+{
+	// command line options
+	command cmd;
+
+	parse_options(&cmd, argc, argv);
+
+	// make sure stdin is closed on exec
+	just(fcntl(STDIN_FILENO, F_SETFD, fcntl(STDIN_FILENO, F_GETFD) | FD_CLOEXEC));
+
+	// get file list
+	str_list* const files = list_files(cmd.dir, cmd.spec, "pgm");
+
+	if(str_list_is_empty(files))
+	{
+		if(cmd.fail_on_empty)
+			error(2, 0, "no pages found");
+
+		return 0;
+	}
+
+	// validate images
+	mem_free(pgm_check_files(files));
+
+	// process pages
+	deskew_state st =
+	{
+		.cmd = &cmd,
+		.files = files,
+		.angles = shared_alloc(files->len * sizeof(double))
+	};
+
+	const job_runner runner = { .run = run_job, .done = job_done, .ctx = &st };
+	const int status = run_jobs(&runner, files->len, cmd.jobs);
+
+	if(status != 0)
+		check_exit_status(status);
+
+	return 0;
+}
@@ -0,0 +1,347 @@
+#include "list_pages.h"
+#include "text_index.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+static const char usage_string[] =
+	"Usage:\t" PROG_NAME " [OPTION]... PATTERN\n\n"
+	"Search the recognised text of the specified range of pages for the given string, and\n"
+	"print the matching lines as \"PAGE:LINE:TEXT\". The search uses the trigram index kept\n"
+	"in the file \".ocr-index\" in the input directory; the index is created on the first\n"
+	"run, and updated on every run from the pages rewritten since the previous one.\n"
+	"Exit status is 0 if a match is found, and 1 otherwise.\n\n"
+	"Options:\n"
+	"  -p,--pages=SPEC\n"
+	"         Pages to search. A page specification contains one or more comma-separated page\n"
+	"         ranges. A page range is either a page number, or two page numbers separated by\n"
+	"         a dash. In the last range, the second page number may be omitted, meaning all\n"
+	"         the remaining pages of the document. For instance, specification \"1-10\" outputs\n"
+	"         pages 1 to 10, and specification \"1,3,5-\" outputs pages 1 and 3, followed by\n"
+	"         all the pages starting from page 5 to the end of the document.\n"
+	"         (optional, default: all pages)\n\n"
+	"  -d,--dir=DIR\n"
+	"         Input directory (optional, default: .)\n\n"
+	"  -i,--ignore-case\n"
+	"         Ignore the case of ASCII letters.\n\n"
+	"  -w,--word\n"
+	"         Match whole words only.\n\n"
+	"  -C,--context=N\n"
+	"         Also print N lines before and after each matching line, as \"PAGE-LINE-TEXT\".\n"
+	"         (optional, default: 0)\n\n"
+	"  -l,--list\n"
+	"         Print only the numbers of the matching pages.\n\n"
+	"  -h,--help\n"
+	"         Show help and exit.\n\n"
+	"  -v,--version\n"
+	"         Show version and exit.\n";
+
+// command line parameters
+typedef struct
+{
+	const char* dir;
+	page_spec* spec;
+	str pattern;
+	bool ignore_case, word, list;
+	unsigned context;
+} command;
+
+// option parser
+static
+void parse_options(command* const cmd, int argc, char* argv[])
+{
+	// options specification
+	static
+	const struct option long_options[] =
+	{
+		{"pages",  required_argument, NULL, 'p'},
+		{"dir",  required_argument, NULL, 'd'},
+		{"ignore-case",  no_argument, NULL, 'i'},
+		{"word",  no_argument, NULL, 'w'},
+		{"context",  required_argument, NULL, 'C'},
+		{"list",  no_argument, NULL, 'l'},
+		{"help",  no_argument, NULL, 'h'},
+		{"version",  no_argument, NULL, 'v'},
+		{NULL, 0, NULL, 0}
+	};
+
+	// prepare target
+	*cmd = (command){ .dir = "." };
+
+	// parser loop
+	int opt, option_index = 0;
+
+	while((opt = getopt_long(argc, argv, "+p:d:iwC:lhv", long_options, &option_index)) >= 0)
+	{
+		switch(opt)
+		{
+			case 'p':
+				if(cmd->spec)
+					free((void*)cmd->spec);
+
+				if(!(cmd->spec = parse_page_spec(optarg)))
+					die(0, "empty parameter specified for -p,--pages option");
+
+				break;
+			case 'd':
+				if(*optarg == 0)
+					die(0, "empty directory name");
+
+				cmd->dir = optarg;
+				break;
+			case 'i':
+				cmd->ignore_case = true;
+				break;
+			case 'w':
+				cmd->word = true;
+				break;
+			case 'C':
+			{
+				char* end;
+				const unsigned long n = strtoul(optarg, &end, 10);
+
+				if(end == optarg || *end != 0 || *optarg == '-' || n > 1000)
+					die(0, "invalid argument for -C,--context option: \"%s\"", optarg);
+
+				cmd->context = n;
+				break;
+			}
+			case 'l':
+				cmd->list = true;
+				break;
+			case 'h':
+				show_usage_and_exit(usage_string);
+				break;
+			case 'v':
+				show_version_and_exit();
+				break;
+			case '?':
+				exit(1);
+			default:
+				die(0, "internal error (getopt_long(3) returned %d)", opt);
+		}
+	}
+
+	if(optind == argc)
+		die(0, "missing search pattern");
+
+	if(argc > optind + 1)
+		die(0, "unexpected argument: \"%s\"", argv[optind + 1]);
+
+	const char* const s = argv[optind];
+
+	if(*s == 0)
+		die(0, "empty search pattern");
+
+	if(strchr(s, '\n'))
+		die(0, "search pattern cannot contain line breaks");
+
+	cmd->pattern = str_ref_from_ptr(s);
+}
+
+// word character: letter, digit, underscore, or any byte of a multibyte UTF-8 character
+static inline
+bool is_word_char(const unsigned char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c >= 0x80;
+}
+
+// check if the line contains the pattern; with ignore_case, the line is compared in the
+// folded copy of the text, and the pattern is already folded
+static
+bool match_line(const command* const cmd, const char* const line, const size_t len, const char* const pat)
+{
+	const size_t n = str_len(cmd->pattern);
+
+	for(const char* s = line, *const end = line + len; s + n <= end; ++s)
+	{
+		if(!(s = memmem(s, end - s, pat, n)))
+			return false;
+
+		if(!cmd->word
+			|| ((s == line || !is_word_char(s[-1])) && (s + n == end || !is_word_char(s[n]))))
+			return true;
+	}
+
+	return false;
+}
+
+// print one line of the page
+static
+void print_line(const unsigned page, const size_t line_no, const char sep,
+				const char* const line, const size_t len)
+{
+	just(printf("%u%c%zu%c%.*s\n", page, sep, line_no, sep, (int)len, line));
+}
+
+// search one page; returns true if the pattern has been found
+static
+bool search_page(const command* const cmd, const char* const name, const unsigned page,
+				 const char* const pat, bool* const need_sep)
+{
+	const int fd = open(name, O_RDONLY | O_CLOEXEC);
+
+	if(fd < 0)
+		die(errno, "cannot open file \"%s\"", name);
+
+	struct stat info;
+
+	just(fstat(fd, &info));
+
+	const size_t size = info.st_size;
+
+	if(size == 0)
+	{
+		just(close(fd));
+		return false;
+	}
+
+	const char* const text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if(text == MAP_FAILED)
+		die(errno, "cannot map file \"%s\"", name);
+
+	just(close(fd));
+
+	// folded copy of the text
+	char* folded = NULL;
+
+	if(cmd->ignore_case)
+	{
+		folded = mem_alloc(size);
+
+		for(size_t i = 0; i < size; ++i)
+			folded[i] = fold_case(text[i]);
+	}
+
+	const char* const src = folded ? folded : text;
+
+	// line offsets
+	size_t num_lines = 0, cap = 64;
+	size_t* lines = mem_alloc((cap + 1) * sizeof(size_t));
+
+	for(const char* s = text, *const end = text + size; s < end; )
+	{
+		const char* const eol = memchr(s, '\n', end - s);
+
+		if(num_lines == cap)
+			lines = mem_realloc(lines, ((cap *= 2) + 1) * sizeof(size_t));
+
+		lines[num_lines++] = s - text;
+		s = eol ? eol + 1 : end;
+	}
+
+	lines[num_lines] = size;
+
+	// matching lines, with the context
+	bool found = false, any = false;
+	size_t printed = 0, after = 0;	// lines printed or skipped so far, trailing context left
+
+	for(size_t i = 0; i < num_lines; ++i)
+	{
+		const size_t off = lines[i];
+		size_t len = lines[i + 1] - off;
+
+		if(len > 0 && text[off + len - 1] == '\n')
+			--len;
+
+		if(match_line(cmd, src + off, len, pat))
+		{
+			found = true;
+
+			if(cmd->list)
+				break;
+
+			const size_t first = max(i - min(i, (size_t)cmd->context), printed);
+
+			// separate the groups of lines not adjacent to each other
+			if(*need_sep && cmd->context > 0 && (first > printed || !any))
+				just(puts("--"));
+
+			for(size_t j = first; j < i; ++j)
+			{
+				const size_t o = lines[j], l = lines[j + 1] - o - 1;	// these lines end with '\n'
+
+				print_line(page, j + 1, '-', text + o, l);
+			}
+
+			print_line(page, i + 1, ':', text + off, len);
+
+			printed = i + 1;
+			after = cmd->context;
+			any = *need_sep = true;
+		}
+		else if(after > 0)
+		{
+			print_line(page, i + 1, '-', text + off, len);
+
+			printed = i + 1;
+			--after;
+		}
+	}
+
+	if(found && cmd->list)
+		just(printf("%u\n", page));
+
+	mem_free(lines);
+	mem_free(folded);
+	munmap((void*)text, size);
+
+	return found;
+}
+
+int main(int argc, char* argv[])
+{
+	// command line options
+	command cmd;
+
+	parse_options(&cmd, argc, argv);
+
+	// make sure stdin is closed on exec
+	just(fcntl(STDIN_FILENO, F_SETFD, fcntl(STDIN_FILENO, F_GETFD) | FD_CLOEXEC));
+
+	// the index covers all the pages, regardless of the page specification
+	str_list* const files = list_files(cmd.dir, NULL, "txt");
+	text_index idx;
+
+	text_index_update(&idx, cmd.dir, files);
+
+	// candidate pages
+	size_t num_pages;
+	uint32_t* const pages = text_index_find(&idx, cmd.pattern, &num_pages);
+
+	// search pattern
+	char* const pat = mem_alloc(str_len(cmd.pattern));
+
+	for(size_t i = 0; i < str_len(cmd.pattern); ++i)
+		pat[i] = cmd.ignore_case ? fold_case(str_ptr(cmd.pattern)[i]) : str_ptr(cmd.pattern)[i];
+
+	// both the candidates and the files are sorted by page number
+	bool found = false, need_sep = false;
+	size_t k = 0;
+
+	for(size_t i = 0; i < num_pages; ++i)
+	{
+		const unsigned page = pages[i];
+
+		if(cmd.spec && !find_page_range(cmd.spec, page))
+			continue;
+
+		while(k < str_list_len(files) && page_no(files->strings[k], str_lit("txt")) < page)
+			++k;
+
+		if(k < str_list_len(files))
+			found |= search_page(&cmd, str_ptr(files->strings[k]), page, pat, &need_sep);
+	}
+
+	mem_free(pat);
+	mem_free(pages);
+	text_index_close(&idx);
+	str_list_free(files);
+
+	return found ? 0 : 1;
+}
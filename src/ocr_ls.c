@@ -1,14 +1,20 @@
 #include "list_pages.h"
+#include "pgm.h"
+#include "jobs.h"
 
+#include <stdio.h>
+#include <string.h>
 #include <limits.h>
 #include <getopt.h>
 #include <fcntl.h>
 #include <sys/uio.h>
+#include <sys/wait.h>
 
 static const char usage_string[] =
 	"Usage:\t" PROG_NAME " [OPTION]... [DIR]\n"
+	"  or:\t" PROG_NAME " [OPTION]... -e [DIR] -- COMMAND [ARG]...\n"
 	"List image or text files (aka pages) produced by ocr-* tools, from the directory DIR,\n"
-	"ordered by page number.\n\n"
+	"ordered by page number, or run the given command for each of them.\n\n"
 	"Options:\n"
 	"  -0,--null\n"
 	"         Output items are terminated by a null character instead of by newline.\n\n"
@@ -24,6 +30,18 @@ static const char usage_string[] =
 	"         (optional, default: all pages)\n\n"
 	"  -f,--fail-on-empty\n"
 	"         Fail if no files found.\n\n"
+	"  -c,--check\n"
+	"         Validate the header and the size of every listed image, and fail without listing\n"
+	"         anything if some of the images are invalid. Cannot be combined with -t option.\n\n"
+	"  -e,--exec\n"
+	"         Instead of listing the files, run the command given after \"--\" once for each file.\n"
+	"         In the command arguments, \"{}\" is replaced with the file name, \"{page}\" with\n"
+	"         the page number, and \"{txt}\" with the name of the page text file. The output\n"
+	"         of the commands is shown in page order, and the pages where the command failed\n"
+	"         are reported at the end.\n\n"
+	"  -j,--jobs=N\n"
+	"         Number of commands to run in parallel (with -e option only).\n"
+	"         (optional, default: 1)\n\n"
 	"  -h,--help\n"
 	"         Show help and exit.\n\n"
 	"  -v,--version\n"
@@ -35,10 +53,12 @@ typedef struct
 	const char *dir, *ext;
 	const page_spec* spec;
 	char delim;
+	char** exec_argv;	// command to run per file, or NULL
+	unsigned jobs;
 } command;
 
 // option parser
-static bool fail_on_empty = false;
+static bool fail_on_empty = false, check_images = false, exec_mode = false;
 
 static
 void parse_options(command* const cmd, int argc, char** argv)
@@ -51,18 +71,21 @@ void parse_options(command* const cmd, int argc, char** argv)
 		{"text",  no_argument, NULL, 't'},
 		{"pages",  required_argument, NULL, 'p'},
 		{"fail-on-empty",  no_argument, NULL, 'f'},
+		{"check",  no_argument, NULL, 'c'},
+		{"exec",  no_argument, NULL, 'e'},
+		{"jobs",  required_argument, NULL, 'j'},
 		{"help",  no_argument, NULL, 'h'},
 		{"version",  no_argument, NULL, 'v'},
 		{NULL, 0, NULL, 0}
 	};
 
 	// prepare target
-	*cmd = (command){ .dir = ".", .ext = "pgm", .delim = '\n' };
+	*cmd = (command){ .dir = ".", .ext = "pgm", .delim = '\n', .jobs = 0 };
 
 	// parser loop
 	int opt, option_index = 0;
 
-	while((opt = getopt_long(argc, argv, "+0tp:fhv", long_options, &option_index)) >= 0)
+	while((opt = getopt_long(argc, argv, "+0tp:fcej:hv", long_options, &option_index)) >= 0)
 	{
 		switch(opt)
 		{
@@ -83,6 +106,15 @@ void parse_options(command* const cmd, int argc, char** argv)
 			case 'f':
 				fail_on_empty = true;
 				break;
+			case 'c':
+				check_images = true;
+				break;
+			case 'e':
+				exec_mode = true;
+				break;
+			case 'j':
+				cmd->jobs = parse_num_jobs(optarg);
+				break;
 			case 'h':
 				show_usage_and_exit(usage_string);
 				break;
@@ -96,8 +128,36 @@ void parse_options(command* const cmd, int argc, char** argv)
 		}
 	}
 
+	if(check_images && strcmp(cmd->ext, "pgm") != 0)
+		die(0, "option -c,--check cannot be used with -t,--text");
+
+	// command, after "--"
+	int end = argc;
+
+	for(int i = optind - 1; i < argc; ++i)
+	{
+		if(i > 0 && strcmp(argv[i], "--") == 0)
+		{
+			end = max(i, optind);
+			cmd->exec_argv = argv + i + 1;
+			break;
+		}
+	}
+
+	if(exec_mode)
+	{
+		if(!cmd->exec_argv || !*cmd->exec_argv)
+			die(0, "missing command for -e,--exec option");
+	}
+	else if(cmd->exec_argv)
+		die(0, "unexpected command arguments without -e,--exec option");
+	else if(cmd->jobs > 0)
+		die(0, "option -j,--jobs can only be used with -e,--exec");
+
+	cmd->jobs = max(cmd->jobs, 1u);
+
 	// directory
-	switch(argc - optind)
+	switch(end - optind)
 	{
 		case 0:
 			break;
@@ -109,6 +169,255 @@ void parse_options(command* const cmd, int argc, char** argv)
 	}
 }
 
+// command runner state
+typedef struct
+{
+	off_t out, err;		// output of the command in the spool file
+	size_t out_len, err_len;
+	int status;
+	bool done;
+} exec_result;
+
+typedef struct
+{
+	const command* cmd;
+	const str_list* files;
+	FILE** outputs;			// stdout and stderr of each running command
+	exec_result* results;
+	int spool;				// output of the commands that is not shown yet
+	off_t spool_size;
+	size_t next;			// next command to show the output of
+	unsigned num_failed;
+} exec_state;
+
+// replace placeholders in the command argument
+static
+char* expand_arg(const char* arg, const str file, const unsigned page)
+{
+	char* res = NULL;
+	size_t size = 0;
+	FILE* const out = just(open_memstream(&res, &size));
+
+	while(*arg)
+	{
+		if(strncmp(arg, "{}", 2) == 0)
+		{
+			just(fputs(str_ptr(file), out));
+			arg += 2;
+		}
+		else if(strncmp(arg, "{page}", 6) == 0)
+		{
+			just(fprintf(out, "%u", page));
+			arg += 6;
+		}
+		else if(strncmp(arg, "{txt}", 5) == 0)
+		{
+			char* const txt = page_file_ext(file, "txt");
+
+			just(fputs(txt, out));
+			free(txt);
+			arg += 5;
+		}
+		else
+			just(fputc(*arg++, out));
+	}
+
+	just(fclose(out));
+
+	return res;
+}
+
+static
+void start_command(void* const ctx, const size_t i)
+{
+	exec_state* const st = ctx;
+
+	for(unsigned k = 0; k < 2; ++k)
+	{
+		FILE* const tmp = tmpfile();
+
+		if(!tmp)
+			die(errno, "cannot create temporary file");
+
+		// keep the files of the other commands from leaking into this one
+		just(fcntl(fileno(tmp), F_SETFD, FD_CLOEXEC));
+
+		st->outputs[2 * i + k] = tmp;
+	}
+}
+
+static
+int run_command(void* const ctx, const size_t i, const unsigned UNUSED(worker))
+{
+	const exec_state* const st = ctx;
+	const str file = st->files->strings[i];
+	const char* const ext = st->cmd->ext;
+
+	// arguments
+	char** const argv = st->cmd->exec_argv;
+	unsigned n = 0;
+
+	while(argv[n])
+		++n;
+
+	char** const args = mem_alloc((n + 1) * sizeof(char*));
+
+	for(unsigned k = 0; k < n; ++k)
+		args[k] = expand_arg(argv[k], file, page_no(file, str_ref(ext)));
+
+	args[n] = NULL;
+
+	// redirections
+	const int null = open("/dev/null", O_RDONLY);
+
+	if(null < 0
+	   || dup2(null, STDIN_FILENO) < 0
+	   || dup2(fileno(st->outputs[2 * i]), STDOUT_FILENO) < 0
+	   || dup2(fileno(st->outputs[2 * i + 1]), STDERR_FILENO) < 0)
+	{
+		error(0, errno, "internal error (redirect)");
+		return 1;
+	}
+
+	execvp(args[0], args);
+
+	error(0, errno, "cannot run \"%s\"", args[0]);
+
+	return (errno == ENOENT) ? 127 : 126;
+}
+
+// copy the given range of one file to another
+static
+void copy_range(const int from, off_t off, size_t len, const int to)
+{
+	char buff[64 * 1024];
+
+	while(len > 0)
+	{
+		const ssize_t n = pread(from, buff, min(len, sizeof(buff)), off);
+
+		if(n <= 0)
+			die(n < 0 ? errno : EIO, "error reading temporary file");
+
+		for(ssize_t k = 0; k < n; )
+		{
+			const ssize_t ret = write(to, buff + k, n - k);
+
+			if(ret < 0)
+				die(errno, "write error");
+
+			k += ret;
+		}
+
+		off += n;
+		len -= n;
+	}
+}
+
+// move the content of the temporary file to the spool
+static
+size_t spool_output(exec_state* const st, FILE* const tmp, off_t* const off)
+{
+	const int fd = fileno(tmp);
+	const off_t len = just(lseek(fd, 0, SEEK_END));
+
+	*off = st->spool_size;
+
+	if(len > 0)
+	{
+		if(st->spool < 0)
+		{
+			FILE* const spool = tmpfile();
+
+			if(!spool)
+				die(errno, "cannot create temporary file");
+
+			st->spool = just(fcntl(fileno(spool), F_DUPFD_CLOEXEC, 0));
+			just(fclose(spool));
+		}
+
+		copy_range(fd, 0, len, st->spool);
+		st->spool_size += len;
+	}
+
+	just(fclose(tmp));
+
+	return len;
+}
+
+static
+void command_done(void* const ctx, const size_t i, const int status)
+{
+	exec_state* const st = ctx;
+	exec_result* const res = &st->results[i];
+
+	res->out_len = spool_output(st, st->outputs[2 * i], &res->out);
+	res->err_len = spool_output(st, st->outputs[2 * i + 1], &res->err);
+	res->status = status;
+	res->done = true;
+
+	// show the output in page order
+	just(fflush(NULL));
+
+	for(; st->next < st->files->len && st->results[st->next].done; ++st->next)
+	{
+		const exec_result* const r = &st->results[st->next];
+
+		copy_range(st->spool, r->out, r->out_len, STDOUT_FILENO);
+		copy_range(st->spool, r->err, r->err_len, STDERR_FILENO);
+
+		if(WIFEXITED(r->status) && WEXITSTATUS(r->status) == 0)
+			continue;
+
+		const unsigned page = page_no(st->files->strings[st->next], str_ref(st->cmd->ext));
+
+		if(WIFEXITED(r->status))
+			error(0, 0, "page %u: command exited with code %d", page, WEXITSTATUS(r->status));
+		else
+			error(0, 0, "page %u: command killed by signal %d: %s",
+				  page, WTERMSIG(r->status), strsignal(WTERMSIG(r->status)));
+
+		++st->num_failed;
+	}
+}
+
+static
+int exec_files(const command* const cmd, const str_list* const files)
+{
+	exec_state st =
+	{
+		.cmd = cmd,
+		.files = files,
+		.outputs = mem_alloc(2 * files->len * sizeof(FILE*)),
+		.results = mem_alloc(files->len * sizeof(exec_result)),
+		.spool = -1
+	};
+
+	memset(st.results, 0, files->len * sizeof(exec_result));
+
+	const job_runner runner =
+	{
+		.start = start_command,
+		.run = run_command,
+		.done = command_done,
+		.ctx = &st,
+		.keep_going = true
+	};
+
+	run_jobs(&runner, files->len, cmd->jobs);
+
+	if(st.spool >= 0)
+		just(close(st.spool));
+
+	mem_free(st.outputs);
+	mem_free(st.results);
+
+	if(st.num_failed > 0)
+		die(0, "command failed on %u of %zu pages", st.num_failed, files->len);
+
+	return 0;
+}
+
 int main(int argc, char** argv)
 {
 	command cmd;
@@ -121,6 +430,12 @@ int main(int argc, char** argv)
 	// get file list
 	str_list* const list = list_files(cmd.dir, cmd.spec, cmd.ext);
 
+	if(check_images)
+		mem_free(pgm_check_files(list));
+
+	if(cmd.exec_argv && !str_list_is_empty(list))
+		return exec_files(&cmd, list);
+
 	if(!str_list_is_empty(list))
 	{
 		str_join_range(stdout, str_ref_chars(&cmd.delim, 1), list->strings, list->len);
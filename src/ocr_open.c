@@ -1,21 +1,38 @@
 #include "page_spec.h"
+#include "list_pages.h"
+#include "render_cache.h"
+#include "ram_store.h"
+#include "jobs.h"
+#include "journal.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include <getopt.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
+#include <glob.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/wait.h>
 
 #include <magic.h>
 
 // usage string
 static
 const char usage_string[] =
-"Usage:\t" PROG_NAME " [OPTION]... FILE\n"
-"Renders pages of a .pdf or .djvu FILE to grayscale images in PGM format.\n"
+"Usage:\t" PROG_NAME " [OPTION]... FILE|DIR\n"
+"Renders pages of a .pdf or .djvu FILE to images in PGM format. The input may\n"
+"also be a TIFF (possibly multi-page), JPEG, or PNG image, or a directory of such images,\n"
+"taken in natural sort order (\"scan-2.tif\" before \"scan-10.tif\"); the images are converted\n"
+"to grayscale using ImageMagick. DjVu pages are stored as bilevel images in PBM format, at\n"
+"the native resolution.\n"
+"Pages already rendered from the same document with the same parameters are not rendered\n"
+"again; the record of the rendered pages is kept in file \".ocr-open\" in the output directory.\n"
 "Options:\n"
 "  -p,--pages=SPEC   Pages to extract. A page specification contains one or more comma-separated page\n"
 "                    ranges. A page range is either a page number, or two page numbers separated by\n"
@@ -25,6 +42,28 @@ const char usage_string[] =
 "                    all the pages starting from page 5 to the end of the document.\n"
 "                    (optional, default: all pages)\n"
 "  -d,--dir=DIR      Output directory; it must exist. (optional, default: .)\n"
+"  -s,--shard        Store the pages in subdirectories of the output directory, 100 pages per\n"
+"                    subdirectory, like \"0012/page-001234.pgm\"; useful for very large documents.\n"
+"                    Pages already present in the output directory are moved there as well.\n"
+"  -F,--force        Render all the specified pages, even those already rendered.\n"
+"  -e,--extract      For PDF documents, extract the embedded image of every page that is a plain\n"
+"                    scan (a single image covering the page) at its native resolution, instead of\n"
+"                    rendering the page; the other pages are rendered as usual.\n"
+"  -j,--jobs=N       Number of renderers or image converters to run in parallel; documents are\n"
+"                    rendered in chunks of up to 50 pages. (optional, default: 1)\n"
+"  -t,--text-layer   For PDF and DjVu documents, take the text of every page that has enough\n"
+"                    of it in the text layer of the document, and store it as the text of the\n"
+"                    page; such pages are not rendered, and are recorded in \".ocr-journal\" file.\n"
+"  -m,--ram=MB       Keep the page images in memory (on tmpfs) instead of the output directory, using\n"
+"                    up to MB megabytes; the least recently used pages are moved to the output\n"
+"                    directory when over the limit. The store is linked from the output directory as\n"
+"                    \".ocr-ram\", and is seen by the other tools along with the output directory;\n"
+"                    it is kept, with its limit, for the next runs. The texts are always stored in\n"
+"                    the output directory. With MB set to 0, all the pages are moved to the output\n"
+"                    directory, and the store is removed. Documents are rendered in chunks small\n"
+"                    enough for all the jobs to fit in the store, as estimated from the first page.\n"
+"  -T,--trace=FILE   Write the timeline of the run to FILE in the trace-event format of\n"
+"                    chrome://tracing and Perfetto, with one lane per job.\n"
 "  -h,--help         Show help and exit.\n"
 "  -v,--version      Show version and exit.\n";
 
@@ -39,8 +78,10 @@ void _check_tty(void)
 }
 
 #define info(fmt, ...)	\
-	if(_is_tty)	\
-		printf("%s: " fmt "\n", program_invocation_name, ##__VA_ARGS__)
+	do {	\
+		if(_is_tty)	\
+			printf("%s: " fmt "\n", program_invocation_name, ##__VA_ARGS__);	\
+	} while(0)
 
 // directory check
 static
@@ -65,8 +106,12 @@ const char* check_dir(const char* dir)
 // command line parameters
 typedef struct
 {
-	const char *file, *dir;
+	const char *file, *dir, *trace;
+	const char* image_dir;		// directory for the new page images: the RAM store, or the output directory
+	const ram_store* ram;		// RAM store, if any
 	const page_spec* spec;
+	bool shard, force, extract, text_layer, has_ram;
+	unsigned jobs, ram_mb;
 } command;
 
 // option parser
@@ -81,16 +126,23 @@ void parse_options(command* const cmd, int argc, char** argv)
 		{"version",  no_argument, 0, 'v'},
 		{"pages",  required_argument, 0, 'p'},
 		{"dir",  required_argument, 0, 'd'},
+		{"shard",  no_argument, 0, 's'},
+		{"force",  no_argument, 0, 'F'},
+		{"jobs",  required_argument, 0, 'j'},
+		{"extract",  no_argument, 0, 'e'},
+		{"text-layer",  no_argument, 0, 't'},
+		{"ram",  required_argument, 0, 'm'},
+		{"trace",  required_argument, 0, 'T'},
 		{0, 0, 0, 0}
 	};
 
 	// prepare target
-	*cmd = (command){0};
+	*cmd = (command){ .jobs = 1 };
 
 	// parser loop
 	int opt, option_index = 0;
 
-	while((opt = getopt_long(argc, argv, "+hvp:d:", long_options, &option_index)) >= 0)
+	while((opt = getopt_long(argc, argv, "+hvp:d:sFj:etm:T:", long_options, &option_index)) >= 0)
 	{
 		switch(opt)
 		{
@@ -113,6 +165,42 @@ void parse_options(command* const cmd, int argc, char** argv)
 
 				cmd->dir = check_dir(optarg);
 				break;
+			case 's':
+				cmd->shard = true;
+				break;
+			case 'F':
+				cmd->force = true;
+				break;
+			case 'j':
+				cmd->jobs = parse_num_jobs(optarg);
+				break;
+			case 'e':
+				cmd->extract = true;
+				break;
+			case 't':
+				cmd->text_layer = true;
+				break;
+			case 'm':
+			{
+				char* end;
+
+				errno = 0;
+
+				const unsigned long mb = strtoul(optarg, &end, 10);
+
+				if(end == optarg || *end != 0 || errno != 0 || !isdigit(*optarg) || mb > 1000000)
+					die(0, "invalid argument for -m,--ram option: \"%s\"", optarg);
+
+				cmd->ram_mb = mb;
+				cmd->has_ram = true;
+				break;
+			}
+			case 'T':
+				if(*optarg == 0)
+					die(0, "empty file name specified for -T,--trace option");
+
+				cmd->trace = optarg;
+				break;
 			case '?':
 				exit(1);
 			default:
@@ -143,79 +231,104 @@ void parse_options(command* const cmd, int argc, char** argv)
 static
 const char* mime_type(const char* const fname)
 {
-	magic_t mg = magic_open(MAGIC_SYMLINK
-							| MAGIC_ERROR
-							| MAGIC_MIME_TYPE
-							| MAGIC_PRESERVE_ATIME
-							| MAGIC_NO_CHECK_CDF
-							| MAGIC_NO_CHECK_COMPRESS
-							| MAGIC_NO_CHECK_TAR
-							| MAGIC_NO_CHECK_TEXT
-							| MAGIC_NO_CHECK_TOKENS);
+	// the database is loaded once, as directories of images are checked file by file
+	static magic_t mg = NULL;
 
 	if(!mg)
-		die(errno, "error opening libmagic");
-
-	if(magic_load(mg, NULL) != 0)
 	{
-		error(0, 0, "cannot load MIME type database: %s", magic_error(mg));
-		magic_close(mg);
-		exit(1);
+		mg = magic_open(MAGIC_SYMLINK
+						| MAGIC_ERROR
+						| MAGIC_MIME_TYPE
+						| MAGIC_PRESERVE_ATIME
+						| MAGIC_NO_CHECK_CDF
+						| MAGIC_NO_CHECK_COMPRESS
+						| MAGIC_NO_CHECK_TAR
+						| MAGIC_NO_CHECK_TEXT
+						| MAGIC_NO_CHECK_TOKENS);
+
+		if(!mg)
+			die(errno, "error opening libmagic");
+
+		if(magic_load(mg, NULL) != 0)
+			die(0, "cannot load MIME type database: %s", magic_error(mg));
 	}
 
 	const char* mime = magic_file(mg, fname);
 
 	if(!mime)
-	{
-		error(0, 0, "%s", magic_error(mg));
-		magic_close(mg);
-		exit(1);
-	}
+		die(0, "%s", magic_error(mg));
 
 	if(!(mime = strdup(mime)))
-	{
-		error(0, errno, "internal error");
-		magic_close(mg);
-		exit(1);
-	}
-
-	magic_close(mg);
+		die(errno, "internal error");
 
 	return mime;
 }
 
-// ddjvu
-static
-void ddjvu(const command* const cmd)
+// ddjvu; the parameters must match the arguments below. The pages are rendered from
+// the bilevel mask layer at the native resolution, and stored as packed bitmaps in PBM
+// format (still named "page-N.pgm"), 8 times smaller than the same images in grey scale.
+#define DDJVU_PARAMS "ddjvu -format=pbm -mode=black"
+
+static __attribute__((noreturn))
+void ddjvu_child(const command* const cmd, const page_range* const range)
 {
 	// format for page names
-	char* fmt = NULL;
-
-	format(&fmt, "%s/page-%%04d.pgm", cmd->dir);
+	char *fmt = NULL, *spec = NULL;
 
-	info("processing file \"%s\"", cmd->file);
+	format(&fmt, "%s/page-%%04d.pgm", cmd->image_dir);
+	format(&spec, "-page=%u-%u", range->first, range->last);
 
 	// exec
-	if(!cmd->spec)
-	{
-		info("extracting all pages");
+	just(execlp("ddjvu", program_invocation_name,
+				"-format=pbm", "-mode=black", "-eachpage",
+				spec, cmd->file, fmt, NULL));
 
-		just(execlp("ddjvu", program_invocation_name,
-					"-format=pgm", "-mode=black", "-eachpage",
-					cmd->file, fmt, NULL));
-	}
-	else
-	{
-		char* spec;
+	abort();	// unreachable
+}
+
+static
+int ddjvu(const command* const cmd, const page_range* const range)
+{
+	just(fflush(NULL));
 
-		format(&spec, "-page=%s", page_spec_to_string(cmd->spec, NULL));
+	const pid_t pid = just(fork());
 
-		info("extracting pages %s", spec + sizeof("-page"));
+	if(pid == 0)
+		ddjvu_child(cmd, range);
 
-		just(execlp("ddjvu", program_invocation_name,
-					"-format=pgm", "-mode=black", "-eachpage",
-					spec, cmd->file, fmt, NULL));
-	}
+	int status;
+
+	just(waitpid(pid, &status, 0));
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 2;
+}
+
+// get the number of pages in a djvu file
+static
+unsigned djvu_num_pages(const char* const fname)
+{
+	char* script = NULL;
+
+	format(&script, "djvused -e n \"%s\" 2>/dev/null", fname);
+
+	FILE* const stream = popen(script, "re");
+
+	free(script);
+
+	if(!stream)
+		die((errno == 0) ? ENOMEM : errno,
+			"error reading the number of pages in file \"%s\"", fname);
+
+	unsigned num_pages;
+	const bool ok = (fscanf(stream, "%u", &num_pages) == 1);
+
+	// discard the rest of the stream
+	while(fgetc(stream) != EOF);
+
+	if(pclose(stream) != 0 || !ok)
+		die(0, "error reading the number of pages in file \"%s\"", fname);
+
+	return num_pages;
 }
 
 // get the number of pages in a pdf file, because pdftoppm gives an error
@@ -318,98 +431,1252 @@ int shell(const char* const script)
 	return ret;
 }
 
-// pdftoppm
+// pdftoppm; the parameters must match the script below
+#define PDFTOPPM_PARAMS "pdftoppm -gray -scale-to 4000"
+
 static
-const char* pdftoppm_script(const char* const fname,
-							const char* const dir,
-							const page_range* const range)
+int pdftoppm(const command* const cmd, const page_range* const range)
 {
-	char range_str[64];
-
-	if(range)
-		sprintf(range_str, "-f %u -l %u", range->first, range->last);
-	else
-		range_str[0] = 0;
-
 	static const char script_fmt[] =
 		"ERR=\"$(mktemp --tmpdir)\" || exit 1 ; "
 		"trap \"rm -f $ERR\" EXIT ; "
-		"pdftoppm -gray -scale-to 4000 %s \"%s\" \"%s/page\" 2>\"$ERR\" "
+		PDFTOPPM_PARAMS " -f %u -l %u \"%s\" \"%s/page\" 2>\"$ERR\" "
 		"|| { grep -vE '^[^:]*\\<[Ww]arning:[[:space:]]+' \"$ERR\" 1>&2 ; exit 1 ; }";
 
 	char* script = NULL;
 
-	format(&script, script_fmt, range_str, fname, dir);
+	format(&script, script_fmt, range->first, range->last, cmd->file, cmd->image_dir);
+
+	const int ret = shell(script);
+
+	free(script);
 
-	return script;
+	return ret;
 }
 
-static __attribute__((noreturn))
-void pdftoppm(const command* const cmd)
+// output file name
+static
+char* page_file_name(const command* const cmd, const unsigned page)
 {
-	// format
-	char* fmt = NULL;
+	if(cmd->shard)
+		return sharded_page_name(cmd->image_dir, page, "pgm");
 
-	format(&fmt, "%s/page", cmd->dir);
+	char* name = NULL;
 
-	info("processing file \"%s\"", cmd->file);
+	format(&name, "%s/page-%04u.pgm", cmd->image_dir, page);
+
+	return name;
+}
+
+// create the directory for the file, if not present
+static
+void make_file_dir(const char* const name)
+{
+	char* const dir = strndup(name, strrchr(name, '/') - name);
+
+	if(!dir)
+		die(errno, "internal error");
+
+	if(mkdir(dir, 0755) != 0 && errno != EEXIST)
+		die(errno, "cannot create directory \"%s\"", dir);
+
+	free(dir);
+}
+
+// create the directory for the page image; for a page sharded in the RAM store, also the
+// shard directory in the output directory, where the tools write the text of the page
+static
+void make_page_dirs(const command* const cmd, const unsigned page, const char* const name)
+{
+	make_file_dir(name);
+
+	if(cmd->shard && cmd->ram)
+	{
+		char* const txt = sharded_page_name(cmd->dir, page, "txt");
+
+		make_file_dir(txt);
+		free(txt);
+	}
+}
+
+// set of page numbers
+typedef struct
+{
+	uint64_t bits[(MAX_PAGE_NO + 64) / 64];
+} page_set;
+
+static inline
+bool has_page(const page_set* const set, const unsigned page)
+{
+	return set->bits[page / 64] & ((uint64_t)1 << (page % 64));
+}
+
+static inline
+void add_page(page_set* const set, const unsigned page)
+{
+	set->bits[page / 64] |= (uint64_t)1 << (page % 64);
+}
+
+static inline
+void del_page(page_set* const set, const unsigned page)
+{
+	set->bits[page / 64] &= ~((uint64_t)1 << (page % 64));
+}
+
+// check if the page is being rendered
+static
+bool is_busy(void* const ctx, const unsigned page)
+{
+	return has_page(ctx, page);
+}
+
+// embedded images of scanned pages
+#define PDFIMAGES_PARAMS "pdfimages"
+
+// min. resolution of a page image to be taken as a scan
+#define MIN_SCAN_PPI 150
+
+// max. difference between the image size at its resolution and the page size, relative
+#define MAX_SCAN_SIZE_DIFF 0.02
+
+// check if the sizes are the same within MAX_SCAN_SIZE_DIFF
+static
+bool same_size(const double a, const double b)
+{
+	return max(a, b) - min(a, b) <= MAX_SCAN_SIZE_DIFF * max(a, b);
+}
+
+// find the pages that are plain scans: exactly one embedded image of a reasonable
+// resolution covering the whole page, and no rotation
+static
+void pdf_find_scans(const char* const fname, const unsigned num_pages, page_set* const scans)
+{
+	unsigned* const images = calloc(num_pages + 1, sizeof(unsigned));
+	bool* const other = calloc(num_pages + 1, sizeof(bool));
+	double* const sizes = calloc(2 * (num_pages + 1), sizeof(double));	// image width and height, in points
+
+	if(!images || !other || !sizes)
+		die(ENOMEM, "internal error");
+
+	// embedded images
+	char* script = NULL;
+
+	format(&script, "pdfimages -list \"%s\" 2>/dev/null", fname);
+
+	FILE* stream = popen(script, "re");
+
+	free(script);
+
+	if(!stream)
+		die((errno == 0) ? ENOMEM : errno, "error listing images in file \"%s\"", fname);
+
+	char* line = NULL;
+	size_t cap = 0;
+
+	// page num type width height color comp bpc enc interp object ID x-ppi y-ppi size ratio
+	while(getline(&line, &cap, stream) >= 0)
+	{
+		unsigned page, width, height, x_ppi, y_ppi;
+		char type[16];
+
+		if(sscanf(line, "%u %*u %15s %u %u %*s %*u %*u %*s %*s %*u %*u %u %u",
+				  &page, type, &width, &height, &x_ppi, &y_ppi) != 6 || page == 0 || page > num_pages)
+			continue;	// header
+
+		if(strcmp(type, "image") == 0 && min(x_ppi, y_ppi) >= MIN_SCAN_PPI)
+		{
+			++images[page];
+			sizes[2 * page] = width * 72.0 / x_ppi;
+			sizes[2 * page + 1] = height * 72.0 / y_ppi;
+		}
+		else
+			other[page] = true;
+	}
+
+	if(pclose(stream) != 0)
+		die(0, "error listing images in file \"%s\"", fname);
 
-	if(!cmd->spec)
+	// page rotation, and the page size: an image not covering the page, like a photo on
+	// a page of text, is not a scan; neither is one placed sideways, as pdfimages extracts
+	// the bitmap as stored
+	format(&script, "pdfinfo -f 1 -l %u \"%s\" 2>/dev/null", num_pages, fname);
+
+	stream = popen(script, "re");
+
+	free(script);
+
+	if(!stream)
+		die((errno == 0) ? ENOMEM : errno, "error reading page information in file \"%s\"", fname);
+
+	while(getline(&line, &cap, stream) >= 0)
 	{
-		// extract all pages in one shot
-		info("extracting all pages");
+		unsigned page, rot;
+		double width, height;
+
+		if(sscanf(line, "Page %u rot: %u", &page, &rot) == 2 && page > 0 && page <= num_pages && rot % 360 != 0)
+			other[page] = true;
+
+		if(sscanf(line, "Page %u size: %lf x %lf", &page, &width, &height) == 3 && page > 0 && page <= num_pages)
+		{
+			const double w = sizes[2 * page], h = sizes[2 * page + 1];
+
+			if(!same_size(w, width) || !same_size(h, height))
+				other[page] = true;
+			else
+				sizes[2 * page] = -1;	// size checked
+		}
+	}
 
-		exit(shell(pdftoppm_script(cmd->file, cmd->dir, NULL)));
+	if(pclose(stream) != 0)
+		die(0, "error reading page information in file \"%s\"", fname);
+
+	free(line);
+
+	unsigned n = 0;
+
+	for(unsigned page = 1; page <= num_pages; ++page)
+	{
+		if(images[page] == 1 && !other[page] && sizes[2 * page] < 0)
+		{
+			add_page(scans, page);
+			++n;
+		}
 	}
 
-	// extract the specified page ranges
-	const unsigned num_pages = pdf_num_pages(cmd->file);
+	free(images);
+	free(other);
+	free(sizes);
+
+	info("pages with a single scanned image: %u of %u", n, num_pages);
+}
+
+// extract the embedded images of the given pages to the page files; pdfimages decodes
+// CCITT, JBIG2 and JPEG images to PBM, PGM or PPM, and colour images are then converted
+// to grey scale
+static
+int pdf_extract(const command* const cmd, const page_range* const range)
+{
+	char *prefix = NULL, *script = NULL;
+
+	format(&prefix, "%s/.extract-%u", cmd->image_dir, range->first);
+	format(&script, PDFIMAGES_PARAMS " -p -f %u -l %u \"%s\" \"%s\"",
+		   range->first, range->last, cmd->file, prefix);
 
-	const page_range* p = cmd->spec->ranges;
-	const page_range* const end = p + cmd->spec->len;
+	int ret = shell(script);
 
-	int ret = 0;
+	free(script);
 
-	for(; ret == 0 && p < end && p->first <= num_pages; ++p)
+	for(unsigned page = range->first; page <= range->last; ++page)
 	{
-		const page_range range = (page_range){ p->first, min(p->last, num_pages) };
+		// file names like PREFIX-PAGE-NUM.EXT, where NUM is counted from the first page
+		char* pattern = NULL;
+		glob_t g;
+
+		format(&pattern, "%s-%03u-*.p[bgp]m", prefix, page);
+
+		const int res = glob(pattern, 0, NULL, &g);
+
+		free(pattern);
+
+		if(ret == 0)
+		{
+			if(res != 0 || g.gl_pathc != 1)
+			{
+				error(0, 0, "page %u: cannot extract the image", page);
+				ret = 1;
+			}
+			else
+			{
+				const char* const src = g.gl_pathv[0];
+				char* const dest = page_file_name(cmd, page);
+
+				make_page_dirs(cmd, page, dest);
 
-		info("extracting pages %u-%u", range.first, range.last);
+				if(strcmp(src + strlen(src) - 3, "ppm") != 0)
+				{
+					if(rename(src, dest) != 0)
+						die(errno, "cannot move \"%s\" to \"%s\"", src, dest);
+				}
+				else
+				{
+					format(&script, "convert \"%s\" -colorspace Gray -depth 8 \"pgm:%s\"", src, dest);
+					ret = shell(script);
+					free(script);
+				}
 
-		const char* const script = pdftoppm_script(cmd->file, cmd->dir, &range);
+				free(dest);
+			}
+		}
 
-		ret = shell(script);
+		// clean up
+		for(size_t i = 0; res == 0 && i < g.gl_pathc; ++i)
+			unlink(g.gl_pathv[i]);
 
-		free((void*)script);
+		if(res == 0)
+			globfree(&g);
 	}
 
-	free_page_spec(cmd->spec);	// useless...
-	exit(ret);
+	free(prefix);
+
+	return ret;
 }
 
-// here we start
-int main(int argc, char** argv)
+// renderer for a document type
+typedef struct
 {
-	if(argc == 1)
-		show_usage_and_exit(usage_string);
+	const char* params;		// rendering parameters, as recorded in the render cache
+	unsigned (*num_pages)(const char* const fname);
+	int (*render)(const command* const cmd, const page_range* const range);
+	void (*find_scans)(const char* const fname, const unsigned num_pages, page_set* const scans);	// optional
+	const char* text_fmt;	// script printing the text layer of page %1$u of file %2$s
+	bool doc_digits;		// the rendered pages are numbered with as many digits as the number of
+							// pages, instead of 4
+} renderer;
+
+// text layer is taken if it has at least this many letters and digits...
+#define TEXT_MIN_CHARS 100
+
+// ...and no more than this percentage of undecodable or control characters
+#define TEXT_MAX_GARBAGE 5
+
+// check if the text is good enough to be used instead of the recognised one; the bytes
+// of multibyte UTF-8 characters are counted as letters once per character
+static
+bool text_is_usable(const char* const text, const size_t len)
+{
+	size_t num_chars = 0, num_garbage = 0;
 
-	command cmd;
+	for(size_t i = 0; i < len; ++i)
+	{
+		const unsigned char c = text[i];
 
-	parse_options(&cmd, argc, argv);
+		if(isalnum(c) || c >= 0xC0)
+		{
+			// U+FFFD replacement character
+			if(c == 0xEF && i + 2 < len && (unsigned char)text[i + 1] == 0xBF && (unsigned char)text[i + 2] == 0xBD)
+				++num_garbage;
+			else
+				++num_chars;
+		}
+		else if(c < 0x20 && c != '\n' && c != '\t' && c != '\r' && c != '\f')
+			++num_garbage;
+	}
 
-	// make sure stdin is closed on exec
-	just(fcntl(STDIN_FILENO, F_SETFD, fcntl(STDIN_FILENO, F_GETFD) | FD_CLOEXEC));
+	return num_chars >= TEXT_MIN_CHARS && num_garbage * 100 <= num_chars * TEXT_MAX_GARBAGE;
+}
 
-	// dispatch on input file MIME type
-	const char* const mime = mime_type(cmd.file);
+// text layer reading state
+typedef struct
+{
+	const command* cmd;
+	const renderer* r;
+	journal* journal;
+	const unsigned* pages;		// pages to read
+	char* const* texts;			// text file names, by index
+	page_set* taken;			// pages with the text taken
+	unsigned num_taken;
+	uint64_t spawn_time;		// time the last page was started, for the trace
+} text_state;
 
-	if(strcmp(mime, "image/vnd.djvu") == 0)
-		ddjvu(&cmd);
-	else if (strcmp(mime, "application/pdf") == 0)
-		pdftoppm(&cmd);
-	else
-		die(0, "cannot process file \"%s\" of type \"%s\"", cmd.file, mime);
+static
+void read_page_start(void* const ctx, const size_t UNUSED(i))
+{
+	text_state* const st = ctx;
+
+	st->spawn_time = trace_time();
+}
+
+// read the text layer of one page, and store it if usable; exit code 0 means the text
+// is stored, and 1 means that it is not usable
+static
+int read_page_text(void* const ctx, const size_t i, const unsigned worker)
+{
+	const text_state* const st = ctx;
+	const unsigned page = st->pages[i];
+
+	trace_span("spawn", worker + 1, page, st->spawn_time);
+
+	uint64_t t = trace_time();
+	char* script = NULL;
+
+	format(&script, st->r->text_fmt, page, st->cmd->file);
+
+	FILE* const stream = popen(script, "re");
+
+	if(!stream)
+		die((errno == 0) ? ENOMEM : errno, "cannot execute \"%s\"", script);
+
+	// whole text
+	size_t len = 0, cap = 4096, n;
+	char* text = mem_alloc(cap);
+
+	while((n = fread(text + len, 1, cap - len, stream)) > 0)
+		if((len += n) == cap)
+			text = mem_realloc(text, cap *= 2);
+
+	if(ferror(stream))
+		die(errno, "error reading the output of \"%s\"", script);
+
+	const int status = pclose(stream);
+
+	trace_span("text layer", worker + 1, page, t);
+
+	if(status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		return 2;
+
+	// the page break after the text
+	while(len > 0 && (text[len - 1] == '\f' || text[len - 1] == '\n'))
+		--len;
+
+	if(!text_is_usable(text, len))
+		return 1;
+
+	text[len++] = '\n';
+
+	// write the text file atomically
+	const char* const txt = st->texts[i];
+	char* tmp = NULL;
+
+	t = trace_time();
+
+	make_file_dir(txt);
+	format(&tmp, "%s.tmp", txt);
+
+	const int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if(fd < 0)
+		die(errno, "cannot create file \"%s\"", tmp);
+
+	if(write(fd, text, len) != (ssize_t)len)
+		die(errno, "error writing file \"%s\"", tmp);
+
+	just(close(fd));
+
+	if(rename(tmp, txt) != 0)
+		die(errno, "cannot rename \"%s\" to \"%s\"", tmp, txt);
+
+	trace_span("write", worker + 1, page, t);
+
+	return 0;
+}
+
+static
+void read_page_done(void* const ctx, const size_t i, const int status)
+{
+	text_state* const st = ctx;
+	const unsigned page = st->pages[i];
+
+	if(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+	{
+		journal_write(st->journal, page, PAGE_TEXT, 0);
+		add_page(st->taken, page);
+		++st->num_taken;
+		return;
+	}
+
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 1)
+		error(0, 0, "page %u: cannot read the text layer", page);
+
+	// the text taken from the previous version of the document is no longer valid
+	if(journal_status(st->journal, page) == PAGE_TEXT)
+	{
+		if(unlink(st->texts[i]) != 0 && errno != ENOENT)
+			die(errno, "cannot remove file \"%s\"", st->texts[i]);
+
+		journal_write(st->journal, page, PAGE_NONE, 0);
+	}
+}
+
+// take the text of the specified pages from the text layer of the document, except the
+// pages already recognised, and add the pages with the text taken to the set; the text
+// goes next to the image of the page, or where the image would be in the output directory
+static
+void read_text_layer(const command* const cmd, const renderer* const r, const unsigned num_pages,
+					 const page_set* const scans, page_set* const taken)
+{
+	unsigned doc_digits = 1;
+
+	for(unsigned n = num_pages; n >= 10; n /= 10)
+		++doc_digits;
+
+	journal j;
+
+	journal_open(&j, cmd->dir);
+
+	// images already present
+	str_list* const files = list_files(cmd->dir, NULL, "pgm");
+	str* const images = mem_alloc((num_pages + 1) * sizeof(str));
+
+	for(unsigned page = 0; page <= num_pages; ++page)
+		images[page] = str_null;
+
+	for(size_t i = 0; i < str_list_len(files); ++i)
+	{
+		const unsigned page = page_no(files->strings[i], str_lit("pgm"));
+
+		if(page <= num_pages)
+			images[page] = files->strings[i];
+	}
+
+	unsigned* const pages = mem_alloc(max(num_pages, 1u) * sizeof(unsigned));
+	char** const texts = mem_alloc(max(num_pages, 1u) * sizeof(char*));
+	size_t n = 0;
+
+	for(unsigned page = 1; page <= num_pages; ++page)
+	{
+		if(cmd->spec && !find_page_range(cmd->spec, page))
+			continue;
+
+		const page_status status = journal_status(&j, page);
+
+		if(status == PAGE_DONE || status == PAGE_BLANK)
+			continue;
 
-	// must never get here
-	abort();
+		pages[n] = page;
+
+		if(!str_is_empty(images[page]))
+			texts[n] = page_file_ext(images[page], "txt");
+		else if(cmd->shard)
+			texts[n] = sharded_page_name(cmd->dir, page, "txt");
+		else
+			format(&texts[n], "%s/page-%0*u.txt", cmd->dir,
+				   (r->doc_digits && !has_page(scans, page)) ? (int)doc_digits : 4, page);
+
+		++n;
+	}
+
+	text_state st = { .cmd = cmd, .r = r, .journal = &j, .pages = pages, .texts = texts, .taken = taken };
+
+	const job_runner runner =
+	{
+		.start = read_page_start,
+		.run = read_page_text,
+		.done = read_page_done,
+		.ctx = &st,
+		.keep_going = true
+	};
+
+	run_jobs(&runner, n, cmd->jobs);
+
+	info("pages with text layer: %u of %zu", st.num_taken, n);
+
+	for(size_t i = 0; i < n; ++i)
+		free(texts[i]);
+
+	mem_free(texts);
+	mem_free(pages);
+	mem_free(images);
+	str_list_free(files);
+	journal_close(&j);
+}
+
+// select the pages to render: the specified pages, except those already rendered from the
+// source with the same hash and with the same parameters (both given per page, from page 1);
+// the outdated images are removed, as the renderers may name them differently. Returns the
+// number of reused pages.
+static
+unsigned select_pages(const command* const cmd, const render_cache* const cache, const char* const* const params,
+					  const uint64_t* const hashes, const unsigned num_pages, page_set* const todo)
+{
+	static page_set present;
+
+	// pages present in the output directory
+	str_list* const files = list_files(cmd->dir, NULL, "pgm");
+
+	for(size_t i = 0; i < str_list_len(files); ++i)
+		add_page(&present, page_no(files->strings[i], str_lit("pgm")));
+
+	unsigned num_reused = 0;
+
+	for(unsigned page = 1; page <= num_pages; ++page)
+	{
+		if(cmd->spec && !find_page_range(cmd->spec, page))
+			continue;
+
+		if(!cmd->force && has_page(&present, page) && render_cache_has(cache, page, hashes[page - 1], params[page - 1]))
+			++num_reused;
+		else
+			add_page(todo, page);
+	}
+
+	for(size_t i = 0; i < str_list_len(files); ++i)
+	{
+		const str file = files->strings[i];
+
+		if(has_page(todo, page_no(file, str_lit("pgm"))) && unlink(str_ptr(file)) != 0)
+			die(errno, "cannot remove file \"%s\"", str_ptr(file));
+	}
+
+	str_list_free(files);
+
+	return num_reused;
+}
+
+// max. number of pages to render in one go, so that an interrupted run loses little
+#define RENDER_CHUNK 50
+
+// chunk of consecutive pages to render, or to extract the images from
+typedef struct
+{
+	page_range range;
+	bool extract;
+} render_chunk;
+
+// document rendering state
+typedef struct
+{
+	const command* cmd;
+	const renderer* r;
+	render_cache* cache;
+	uint64_t hash;					// document hash
+	const char* const* params;		// rendering parameters per page, from page 1
+	const render_chunk* chunks;
+	page_set* busy;					// pages being rendered
+	unsigned num_rendered, num_extracted;
+	uint64_t spawn_time;			// time the last chunk was started, for the trace
+} render_state;
+
+static
+void render_start(void* const ctx, const size_t i)
+{
+	render_state* const st = ctx;
+	const render_chunk* const c = &st->chunks[i];
+
+	st->spawn_time = trace_time();
+
+	for(unsigned page = c->range.first; page <= c->range.last; ++page)
+		add_page(st->busy, page);
+
+	info("%s pages %u-%u", c->extract ? "extracting images from" : "extracting", c->range.first, c->range.last);
+}
+
+static
+int render_pages(void* const ctx, const size_t i, const unsigned worker)
+{
+	const render_state* const st = ctx;
+	const render_chunk* const c = &st->chunks[i];
+
+	trace_span_range("spawn", worker + 1, c->range.first, c->range.last, st->spawn_time);
+
+	const uint64_t t = trace_time();
+	const int ret = c->extract ? pdf_extract(st->cmd, &c->range) : st->r->render(st->cmd, &c->range);
+
+	trace_span_range(c->extract ? "extract" : "render", worker + 1, c->range.first, c->range.last, t);
+
+	return ret;
+}
+
+static
+void render_done(void* const ctx, const size_t i, const int status)
+{
+	render_state* const st = ctx;
+	const render_chunk* const c = &st->chunks[i];
+
+	if(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+	{
+		for(unsigned page = c->range.first; page <= c->range.last; ++page)
+			render_cache_add(st->cache, page, st->hash, st->params[page - 1]);
+
+		*(c->extract ? &st->num_extracted : &st->num_rendered) += c->range.last - c->range.first + 1;
+	}
+	else
+		error(0, 0, "pages %u-%u: %s failed", c->range.first, c->range.last, c->extract ? "extraction" : "rendering");
+
+	for(unsigned page = c->range.first; page <= c->range.last; ++page)
+		del_page(st->busy, page);
+
+	if(st->cmd->ram)
+		ram_store_trim(st->cmd->ram, is_busy, st->busy);
+}
+
+// chunks of consecutive pages of the same kind from the given page on; returns the number
+// of chunks
+static
+size_t make_render_chunks(const page_set* const todo, const page_set* const scans, const unsigned first,
+						  const unsigned num_pages, const unsigned chunk_size, render_chunk* const chunks)
+{
+	size_t num_chunks = 0;
+
+	for(unsigned page = first; page <= num_pages; ++page)
+	{
+		if(!has_page(todo, page))
+			continue;
+
+		render_chunk c = { { page, page }, has_page(scans, page) };
+
+		while(c.range.last < num_pages && c.range.last - c.range.first + 1 < chunk_size
+			  && has_page(todo, c.range.last + 1) && has_page(scans, c.range.last + 1) == c.extract)
+			++c.range.last;
+
+		chunks[num_chunks++] = c;
+		page = c.range.last;
+	}
+
+	return num_chunks;
+}
+
+// size of the rendered page image, or 0 if not found
+static
+uint64_t rendered_page_size(const command* const cmd, const unsigned page)
+{
+	str_list* const files = list_files(cmd->dir, NULL, "pgm");
+	uint64_t size = 0;
+
+	for(size_t i = 0; i < str_list_len(files) && size == 0; ++i)
+	{
+		struct stat info;
+
+		if(page_no(files->strings[i], str_lit("pgm")) == page && stat(str_ptr(files->strings[i]), &info) == 0)
+			size = info.st_size;
+	}
+
+	str_list_free(files);
+
+	return size;
+}
+
+// render the specified pages of the document that are not already rendered
+static
+int render_document(const command* const cmd, const renderer* const r)
+{
+	info("processing file \"%s\"", cmd->file);
+
+	render_cache cache;
+
+	render_cache_open(&cache, cmd->dir);
+
+	const uint64_t hash = render_cache_file_hash(&cache, cmd->file);
+	const unsigned num_pages = min(r->num_pages(cmd->file), (unsigned)MAX_PAGE_NO);
+
+	// pages to extract the images from
+	static page_set scans;
+
+	if(cmd->extract)
+	{
+		if(!r->find_scans)
+			die(0, "option -e,--extract is only supported for PDF documents");
+
+		r->find_scans(cmd->file, num_pages, &scans);
+	}
+
+	// all pages come from the same source
+	uint64_t* const hashes = mem_alloc(max(num_pages, 1u) * sizeof(uint64_t));
+	const char** const params = mem_alloc(max(num_pages, 1u) * sizeof(const char*));
+
+	for(unsigned i = 0; i < num_pages; ++i)
+	{
+		hashes[i] = hash;
+		params[i] = has_page(&scans, i + 1) ? PDFIMAGES_PARAMS : r->params;
+	}
+
+	static page_set todo;
+	const unsigned num_reused = select_pages(cmd, &cache, params, hashes, num_pages, &todo);
+
+	mem_free(hashes);
+
+	// pages with usable text in the text layer need no rendering
+	if(cmd->text_layer)
+	{
+		static page_set taken;
+
+		read_text_layer(cmd, r, num_pages, &scans, &taken);
+
+		for(unsigned page = 1; page <= num_pages; ++page)
+			if(has_page(&taken, page))
+				del_page(&todo, page);
+	}
+
+	// chunks of consecutive pages of the same kind, small enough to keep all the workers busy
+	unsigned num_todo = 0;
+
+	for(unsigned page = 1; page <= num_pages; ++page)
+		num_todo += has_page(&todo, page);
+
+	unsigned chunk_size = min(max((num_todo + cmd->jobs - 1) / cmd->jobs, 1u), (unsigned)RENDER_CHUNK);
+	render_chunk* const chunks = mem_alloc(max(num_pages, 1u) * sizeof(render_chunk));
+
+	// render the chunks in parallel
+	static page_set busy;
+
+	render_state st =
+	{
+		.cmd = cmd,
+		.r = r,
+		.cache = &cache,
+		.hash = hash,
+		.params = params,
+		.chunks = chunks,
+		.busy = &busy
+	};
+
+	const job_runner runner = { .start = render_start, .run = render_pages, .done = render_done, .ctx = &st };
+	unsigned first = 1;
+	int status = 0;
+
+	// the pages being rendered stay in the RAM store until their chunk is done, so the first
+	// page is rendered on its own, and its size limits the chunks to what fits in the store
+	if(cmd->ram && num_todo > 1)
+	{
+		while(!has_page(&todo, first))
+			++first;
+
+		chunks[0] = (render_chunk){ { first, first }, has_page(&scans, first) };
+		status = run_jobs(&runner, 1, 1);
+
+		const uint64_t size = rendered_page_size(cmd, first++);
+
+		if(size > 0)
+			chunk_size = min(chunk_size, (unsigned)max(cmd->ram->cap / (size * cmd->jobs), (uint64_t)1));
+	}
+
+	if(status == 0)
+		status = run_jobs(&runner, make_render_chunks(&todo, &scans, first, num_pages, chunk_size, chunks), cmd->jobs);
+
+	mem_free(chunks);
+	mem_free(params);
+	render_cache_close(&cache);
+
+	if(cmd->extract)
+		info("pages rendered: %u, extracted: %u, reused: %u", st.num_rendered, st.num_extracted, num_reused);
+	else
+		info("pages rendered: %u, reused: %u", st.num_rendered, num_reused);
+
+	if(status == 0)
+		return 0;
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 2;
+}
+
+// document renderers
+static
+const renderer djvu_renderer =
+{
+	.params = DDJVU_PARAMS,
+	.num_pages = djvu_num_pages,
+	.render = ddjvu,
+	.text_fmt = "djvutxt --page=%1$u \"%2$s\" 2>/dev/null"
+};
+
+static
+const renderer pdf_renderer =
+{
+	.params = PDFTOPPM_PARAMS,
+	.num_pages = pdf_num_pages,
+	.render = pdftoppm,
+	.find_scans = pdf_find_scans,
+	.text_fmt = "pdftotext -enc UTF-8 -layout -f %1$u -l %1$u \"%2$s\" - 2>/dev/null",
+	.doc_digits = true
+};
+
+// raster images; the parameters must match the arguments in convert_page()
+#define CONVERT_PARAMS "convert -background white -alpha remove -colorspace Gray -depth 8"
+
+static
+bool is_image_type(const char* const mime)
+{
+	return strcmp(mime, "image/tiff") == 0
+		|| strcmp(mime, "image/jpeg") == 0
+		|| strcmp(mime, "image/png") == 0;
+}
+
+static
+int cmp_names(const void* const a, const void* const b)
+{
+	return strverscmp(str_ptr(*(const str*)a), str_ptr(*(const str*)b));
+}
+
+// list the images in the directory, in natural sort order, so that "scan-2.tif"
+// comes before "scan-10.tif"
+static
+str_list* list_images(const char* const dir)
+{
+	DIR* const d = opendir(dir);
+
+	if(!d)
+		die(errno, "cannot open directory \"%s\"", dir);
+
+	str_list* list = NULL;
+	const struct dirent* ent;
+
+	while((errno = 0, ent = readdir(d)))
+	{
+		if(ent->d_name[0] == '.')
+			continue;
+
+		char* name = NULL;
+		struct stat info;
+
+		format(&name, "%s/%s", dir, ent->d_name);
+
+		const char* const mime = (stat(name, &info) == 0 && S_ISREG(info.st_mode)) ? mime_type(name) : NULL;
+
+		if(mime && is_image_type(mime))
+			list = str_list_append(list, str_acquire(name));
+		else
+			free(name);
+
+		free((void*)mime);
+	}
+
+	if(errno != 0)
+		die(errno, "cannot read directory \"%s\"", dir);
+
+	just(closedir(d));
+
+	if(str_list_is_empty(list))
+		die(0, "no TIFF, JPEG, or PNG images found in \"%s\"", dir);
+
+	qsort(list->strings, list->len, sizeof(str), cmp_names);
+
+	return list;
+}
+
+// get the number of frames in the image
+static
+unsigned image_num_frames(const char* const fname)
+{
+	// only TIFF images may have more than one
+	const char* const mime = mime_type(fname);
+	const bool tiff = (strcmp(mime, "image/tiff") == 0);
+
+	free((void*)mime);
+
+	if(!tiff)
+		return 1;
+
+	char* script = NULL;
+
+	format(&script, "identify -format '%%n\\n' \"%s\" 2>/dev/null", fname);
+
+	FILE* const stream = popen(script, "re");
+
+	free(script);
+
+	if(!stream)
+		die((errno == 0) ? ENOMEM : errno,
+			"error reading the number of frames in file \"%s\"", fname);
+
+	unsigned num_frames;
+	const bool ok = (fscanf(stream, "%u", &num_frames) == 1);
+
+	// discard the rest of the stream
+	while(fgetc(stream) != EOF);
+
+	if(pclose(stream) != 0 || !ok || num_frames == 0)
+		die(0, "error reading the number of frames in file \"%s\"", fname);
+
+	return num_frames;
+}
+
+// page image source: a frame of an input image
+typedef struct
+{
+	const char* file;
+	unsigned frame;
+} image_source;
+
+// conversion state
+typedef struct
+{
+	const command* cmd;
+	render_cache* cache;
+	const image_source* sources;	// by page number, from 1
+	const uint64_t* hashes;			// by page number, from 1
+	const unsigned* pages;			// pages to render
+	page_set* busy;					// pages being rendered
+	unsigned num_rendered;
+	uint64_t spawn_time;			// time the last page was started, for the trace
+} convert_state;
+
+static
+void convert_start(void* const ctx, const size_t i)
+{
+	convert_state* const st = ctx;
+
+	st->spawn_time = trace_time();
+	add_page(st->busy, st->pages[i]);
+
+	if(st->cmd->shard)
+	{
+		char* const name = page_file_name(st->cmd, st->pages[i]);
+
+		make_page_dirs(st->cmd, st->pages[i], name);
+		free(name);
+	}
+}
+
+static
+int convert_page(void* const ctx, const size_t i, const unsigned worker)
+{
+	const convert_state* const st = ctx;
+	const unsigned page = st->pages[i];
+	const image_source* const src = &st->sources[page];
+
+	trace_span("spawn", worker + 1, page, st->spawn_time);
+
+	char *in = NULL, *out = NULL;
+
+	format(&in, "%s[%u]", src->file, src->frame);
+	format(&out, "pgm:%s", page_file_name(st->cmd, page));
+
+	const uint64_t t = trace_time();
+	const pid_t pid = just(fork());
+
+	if(pid == 0)
+	{
+		execlp("convert", "convert", in,
+			   "-background", "white", "-alpha", "remove", "-colorspace", "Gray", "-depth", "8",
+			   out, NULL);
+
+		error(0, errno, "cannot execute \"convert\"");
+		_exit(127);
+	}
+
+	int status;
+
+	just(waitpid(pid, &status, 0));
+	trace_span("convert", worker + 1, page, t);
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static
+void convert_done(void* const ctx, const size_t i, const int status)
+{
+	convert_state* const st = ctx;
+	const unsigned page = st->pages[i];
+
+	if(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+	{
+		render_cache_add(st->cache, page, st->hashes[page], CONVERT_PARAMS);
+		++st->num_rendered;
+	}
+	else
+		error(0, 0, "page %u: cannot convert image \"%s\"", page, st->sources[page].file);
+
+	del_page(st->busy, page);
+
+	if(st->cmd->ram)
+		ram_store_trim(st->cmd->ram, is_busy, st->busy);
+}
+
+// convert the specified pages from the images that are not already converted
+static
+int render_images(const command* const cmd, str_list* const images)
+{
+	info("processing %zu image file(s)", images->len);
+
+	render_cache cache;
+
+	render_cache_open(&cache, cmd->dir);
+
+	// page sources, numbered from 1
+	size_t num_pages = 0, cap = 0;
+	image_source* sources = NULL;
+	uint64_t* hashes = NULL;
+
+	for(size_t i = 0; i < images->len; ++i)
+	{
+		const char* const file = str_ptr(images->strings[i]);
+		const unsigned num_frames = image_num_frames(file);
+		const uint64_t hash = render_cache_file_hash(&cache, file);
+
+		for(unsigned frame = 0; frame < num_frames; ++frame)
+		{
+			if(num_pages == MAX_PAGE_NO)
+				die(0, "too many pages (max. %u)", MAX_PAGE_NO);
+
+			if(num_pages + 1 >= cap)
+			{
+				cap = cap ? 2 * cap : 256;
+				sources = mem_realloc(sources, cap * sizeof(image_source));
+				hashes = mem_realloc(hashes, cap * sizeof(uint64_t));
+			}
+
+			++num_pages;
+			sources[num_pages] = (image_source){ file, frame };
+			hashes[num_pages] = hash_combine(hash, frame);
+		}
+	}
+
+	const char** const params = mem_alloc(max(num_pages, (size_t)1) * sizeof(const char*));
+
+	for(size_t i = 0; i < num_pages; ++i)
+		params[i] = CONVERT_PARAMS;
+
+	static page_set todo;
+	const unsigned num_reused = select_pages(cmd, &cache, params, hashes + 1, num_pages, &todo);
+
+	mem_free(params);
+
+	// pages to convert
+	unsigned* const pages = mem_alloc(max(num_pages, (size_t)1) * sizeof(unsigned));
+	size_t num_todo = 0;
+
+	for(unsigned page = 1; page <= num_pages; ++page)
+		if(has_page(&todo, page))
+			pages[num_todo++] = page;
+
+	static page_set busy;
+
+	convert_state st =
+	{
+		.cmd = cmd,
+		.cache = &cache,
+		.sources = sources,
+		.hashes = hashes,
+		.pages = pages,
+		.busy = &busy
+	};
+
+	const job_runner runner = { .start = convert_start, .run = convert_page, .done = convert_done, .ctx = &st };
+	const int status = run_jobs(&runner, num_todo, cmd->jobs);
+
+	render_cache_close(&cache);
+
+	info("pages rendered: %u, reused: %u", st.num_rendered, num_reused);
+
+	mem_free(pages);
+	mem_free(hashes);
+	mem_free(sources);
+
+	if(status == 0)
+		return 0;
+
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 2;
+}
+
+// move the file to the given name, if it exists
+static
+bool move_file(const char* const from, const char* const to)
+{
+	if(rename(from, to) == 0)
+		return true;
+
+	if(errno != ENOENT)
+		die(errno, "cannot move \"%s\" to \"%s\"", from, to);
+
+	return false;
+}
+
+// move the pages from the output directory to the shard subdirectories; the pages in the
+// RAM store are sharded within the store
+static
+void shard_pages(const command* const cmd)
+{
+	str_list* const files = list_files(cmd->dir, NULL, "pgm");
+	const str ram = cmd->ram ? str_ref(cmd->ram->dir) : str_null;
+	unsigned n = 0;
+
+	for(size_t i = 0; i < str_list_len(files); ++i)
+	{
+		const str file = files->strings[i];
+		const unsigned page = page_no(file, str_lit("pgm"));
+		const bool in_ram = cmd->ram && str_has_prefix(file, ram) && str_ptr(file)[str_len(ram)] == '/';
+		char* const name = sharded_page_name(in_ram ? cmd->ram->dir : cmd->dir, page, "pgm");
+
+		// the text of a page in the RAM store is in the output directory
+		if(in_ram)
+			make_page_dirs(cmd, page, name);
+
+		if(strcmp(name, str_ptr(file)) != 0)
+		{
+			make_file_dir(name);
+			move_file(str_ptr(file), name);
+
+			// the text of the page, if any
+			char *txt_from = page_file_ext(file, "txt"), *txt_to = sharded_page_name(cmd->dir, page, "txt");
+
+			move_file(txt_from, txt_to);
+
+			free(txt_from);
+			free(txt_to);
+			++n;
+		}
+
+		free(name);
+	}
+
+	str_list_free(files);
+
+	info("pages moved to shard directories: %u", n);
+}
+
+// here we start
+int main(int argc, char** argv)
+{
+	if(argc == 1)
+		show_usage_and_exit(usage_string);
+
+	command cmd;
+
+	parse_options(&cmd, argc, argv);
+
+	// make sure stdin is closed on exec
+	just(fcntl(STDIN_FILENO, F_SETFD, fcntl(STDIN_FILENO, F_GETFD) | FD_CLOEXEC));
+
+	if(cmd.trace)
+		trace_open(cmd.trace, cmd.jobs);
+
+	// RAM store
+	ram_store ram;
+
+	cmd.image_dir = cmd.dir;
+
+	if(cmd.has_ram && cmd.ram_mb == 0)
+	{
+		if(ram_store_open(&ram, cmd.dir, 0))
+		{
+			ram_store_remove(&ram);
+			info("RAM store removed");
+		}
+	}
+	else if(ram_store_open(&ram, cmd.dir, (uint64_t)cmd.ram_mb << 20))
+	{
+		cmd.ram = &ram;
+		cmd.image_dir = ram.dir;
+	}
+
+	// dispatch on input file MIME type
+	struct stat info;
+
+	if(stat(cmd.file, &info) != 0)
+		die(errno, "cannot stat \"%s\"", cmd.file);
+
+	const char* const mime = S_ISDIR(info.st_mode) ? NULL : mime_type(cmd.file);
+	const renderer* r = NULL;
+
+	if(!mime || is_image_type(mime))
+	{
+		if(cmd.text_layer)
+			die(0, "option -t,--text-layer is only supported for PDF and DjVu documents");
+	}
+	else if(strcmp(mime, "image/vnd.djvu") == 0)
+		r = &djvu_renderer;
+	else if (strcmp(mime, "application/pdf") == 0)
+		r = &pdf_renderer;
+	else
+		die(0, "cannot process file \"%s\" of type \"%s\"", cmd.file, mime);
+
+	int ret;
+
+	if(r)
+		ret = render_document(&cmd, r);
+	else if(!mime)
+		ret = render_images(&cmd, list_images(cmd.file));
+	else
+		ret = render_images(&cmd, str_list_append_copy(NULL, str_ref_from_ptr(cmd.file)));
+
+	if(ret == 0 && cmd.shard)
+		shard_pages(&cmd);
+
+	if(cmd.ram)
+		ram_store_trim(&ram, NULL, NULL);
+
+	if(cmd.ram)
+		ram_store_close(&ram);
+
+	free_page_spec(cmd.spec);	// useless...
+
+	return ret;
 }
@@ -0,0 +1,415 @@
+#include "list_pages.h"
+#include "pgm.h"
+#include "crop.h"
+#include "binarize.h"
+#include "deskew.h"
+#include "jobs.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/wait.h>
+
+#define info(fmt, ...) just(printf("%s: " fmt "\n", program_invocation_name, ##__VA_ARGS__))
+
+static const char usage_string[] =
+	"Usage:\t" PROG_NAME " [OPTION]... OPERATION...\n\n"
+	"Apply the given chain of operations to the page images from the specified range of pages.\n"
+	"Each image is read once, the operations are applied in memory in the given order, and\n"
+	"the result is written once, replacing the image in place (in PBM format, if the image is\n"
+	"bilevel).\n\n"
+	"Operations:\n"
+	"  crop=L,T,R,B\n"
+	"         Crop L, T, R, and B percent of the image from the left, top, right, and bottom\n"
+	"         edges respectively, like \"crop-image\" script.\n\n"
+	"  trim[=FUZZ]\n"
+	"         Crop the image to its content, that is, to the pixels darker than white by more\n"
+	"         than FUZZ percent. (default: 2)\n\n"
+	"  border[=PERCENT]\n"
+	"         Add white border PERCENT of the image width (on the left and right) and of\n"
+	"         the image height (on the top and bottom) thick. \"trim,border\" does the same as\n"
+	"         \"norm-image\" script. (default: 5)\n\n"
+	"  binarize[=otsu|sauvola[,WINDOW[,K]]]\n"
+	"         Convert the image to bilevel, like \"ocr-binarize\" tool. (default: sauvola,51,0.34)\n\n"
+	"  deskew[=MAX[,MIN]]\n"
+	"         Correct the skew of up to MAX degrees, unless it is below MIN degrees, like\n"
+	"         \"ocr-deskew\" tool. (default: 5,0.1)\n\n"
+	"Options:\n"
+	"  -p,--pages=SPEC\n"
+	"         Pages to process. A page specification contains one or more comma-separated page\n"
+	"         ranges. A page range is either a page number, or two page numbers separated by\n"
+	"         a dash. In the last range, the second page number may be omitted, meaning all\n"
+	"         the remaining pages of the document. For instance, specification \"1-10\" outputs\n"
+	"         pages 1 to 10, and specification \"1,3,5-\" outputs pages 1 and 3, followed by\n"
+	"         all the pages starting from page 5 to the end of the document.\n"
+	"         (optional, default: all pages)\n\n"
+	"  -d,--dir=DIR\n"
+	"         Input directory (optional, default: .)\n\n"
+	"  -j,--jobs=N\n"
+	"         Number of pages to process in parallel.\n"
+	"         (optional, default: 1)\n\n"
+	"  -f,--fail-on-empty\n"
+	"         Fail if no files found.\n\n"
+	"  -h,--help\n"
+	"         Show help and exit.\n\n"
+	"  -v,--version\n"
+	"         Show version and exit.\n";
+
+// operations
+typedef enum { OP_CROP, OP_TRIM, OP_BORDER, OP_BINARIZE, OP_DESKEW } op_kind;
+
+typedef struct
+{
+	op_kind kind;
+	double args[4];		// crop: L, T, R, B; trim: fuzz; border: size; binarize: window, k; deskew: max, min
+	bool otsu;
+} operation;
+
+// command line parameters
+typedef struct
+{
+	const char* dir;
+	page_spec* spec;
+	operation* ops;
+	unsigned num_ops;
+	unsigned jobs;
+	bool fail_on_empty;
+} command;
+
+// parse comma-separated numbers into the given array, keeping the defaults for the missing
+// ones; returns the number of values parsed
+static
+unsigned parse_numbers(const char* const op, const char* s, double* const vals, const unsigned max_vals,
+					   const double from, const double to)
+{
+	unsigned n = 0;
+
+	while(*s)
+	{
+		char* end;
+
+		errno = 0;
+
+		const double val = strtod(s, &end);
+
+		if(end == s || errno != 0 || !isfinite(val) || (*end != 0 && *end != ',') || n == max_vals)
+			die(0, "invalid argument for operation \"%s\"", op);
+
+		if(val < from || val > to)
+			die(0, "argument for operation \"%s\" is out of range", op);
+
+		vals[n++] = val;
+		s = (*end == ',') ? end + 1 : end;
+	}
+
+	return n;
+}
+
+// parse one operation, like "crop=0,0,0,6.5"
+static
+operation parse_operation(const char* const arg)
+{
+	const char* const eq = strchr(arg, '=');
+	const size_t len = eq ? (size_t)(eq - arg) : strlen(arg);
+	const char* const params = eq ? eq + 1 : "";
+
+#define is_op(name)	(len == sizeof(name) - 1 && memcmp(arg, (name), len) == 0)
+
+	if(eq && *params == 0)
+		die(0, "empty argument for operation \"%s\"", arg);
+
+	if(is_op("crop"))
+	{
+		operation op = { .kind = OP_CROP };
+
+		if(parse_numbers(arg, params, op.args, 4, 0, 99.99) != 4)
+			die(0, "operation \"crop\" requires 4 arguments: \"%s\"", arg);
+
+		if(op.args[0] + op.args[2] >= 100 || op.args[1] + op.args[3] >= 100)
+			die(0, "operation \"%s\" leaves nothing of the image", arg);
+
+		return op;
+	}
+
+	if(is_op("trim"))
+	{
+		operation op = { .kind = OP_TRIM, .args = { 2 } };
+
+		parse_numbers(arg, params, op.args, 1, 0, 50);
+		return op;
+	}
+
+	if(is_op("border"))
+	{
+		operation op = { .kind = OP_BORDER, .args = { 5 } };
+
+		parse_numbers(arg, params, op.args, 1, 0, 100);
+		return op;
+	}
+
+	if(is_op("binarize"))
+	{
+		operation op = { .kind = OP_BINARIZE, .args = { 51, 0.34 } };
+
+		if(strcmp(params, "otsu") == 0)
+			op.otsu = true;
+		else if(strncmp(params, "sauvola", 7) == 0 && (params[7] == 0 || params[7] == ','))
+		{
+			if(params[7] == ',')
+				parse_numbers(arg, params + 8, op.args, 2, 0.01, 1001);
+
+			if(op.args[0] < 3 || op.args[0] != floor(op.args[0]) || fmod(op.args[0], 2) == 0 || op.args[1] > 1)
+				die(0, "invalid argument for operation \"%s\"", arg);
+		}
+		else if(*params)
+			die(0, "invalid argument for operation \"%s\"", arg);
+
+		return op;
+	}
+
+	if(is_op("deskew"))
+	{
+		operation op = { .kind = OP_DESKEW, .args = { 5, 0.1 } };
+
+		parse_numbers(arg, params, op.args, 2, 0, 15);
+
+		if(op.args[0] < 0.5)
+			die(0, "argument for operation \"%s\" is out of range", arg);
+
+		return op;
+	}
+
+#undef is_op
+
+	die(0, "unknown operation: \"%s\"", arg);
+	abort();	// unreachable
+}
+
+// option parser
+static
+void parse_options(command* const cmd, int argc, char* argv[])
+{
+	// options specification
+	static
+	const struct option long_options[] =
+	{
+		{"pages",  required_argument, NULL, 'p'},
+		{"dir",  required_argument, NULL, 'd'},
+		{"jobs",  required_argument, NULL, 'j'},
+		{"fail-on-empty",  no_argument, NULL, 'f'},
+		{"help",  no_argument, NULL, 'h'},
+		{"version",  no_argument, NULL, 'v'},
+		{NULL, 0, NULL, 0}
+	};
+
+	// prepare target
+	*cmd = (command){ .dir = ".", .jobs = 1 };
+
+	// parser loop
+	int opt, option_index = 0;
+
+	while((opt = getopt_long(argc, argv, "+p:d:j:fhv", long_options, &option_index)) >= 0)
+	{
+		switch(opt)
+		{
+			case 'p':
+				if(cmd->spec)
+					free((void*)cmd->spec);
+
+				if(!(cmd->spec = parse_page_spec(optarg)))
+					die(0, "empty parameter specified for -p,--pages option");
+
+				break;
+			case 'd':
+				if(*optarg == 0)
+					die(0, "empty directory name");
+
+				cmd->dir = optarg;
+				break;
+			case 'j':
+				cmd->jobs = parse_num_jobs(optarg);
+				break;
+			case 'f':
+				cmd->fail_on_empty = true;
+				break;
+			case 'h':
+				show_usage_and_exit(usage_string);
+				break;
+			case 'v':
+				show_version_and_exit();
+				break;
+			case '?':
+				exit(1);
+			default:
+				die(0, "internal error (getopt_long(3) returned %d)", opt);
+		}
+	}
+
+	// operations
+	if(optind == argc)
+		die(0, "no operations specified");
+
+	cmd->num_ops = argc - optind;
+	cmd->ops = mem_alloc(cmd->num_ops * sizeof(operation));
+
+	for(unsigned i = 0; i < cmd->num_ops; ++i)
+		cmd->ops[i] = parse_operation(argv[optind + i]);
+}
+
+// page outcome, written by the child process
+typedef struct
+{
+	unsigned width, height;
+	double angle;
+	bool deskewed;
+} prep_result;
+
+// processing state
+typedef struct
+{
+	const command* cmd;
+	const str_list* files;
+	prep_result* results;	// shared with child processes
+} prep_state;
+
+static
+void apply(const operation* const op, image* const img, prep_result* const res, const unsigned page)
+{
+	switch(op->kind)
+	{
+		case OP_CROP:
+		{
+			const unsigned w = img->width, h = img->height;
+			const unsigned l = lround(op->args[0] * w / 100), t = lround(op->args[1] * h / 100),
+						   r = lround(op->args[2] * w / 100), b = lround(op->args[3] * h / 100);
+
+			if(l + r >= w || t + b >= h)
+				die(0, "page %u: nothing left of the image after cropping", page);
+
+			image_crop(img, l, t, w - l - r, h - t - b);
+			break;
+		}
+		case OP_TRIM:
+		{
+			unsigned x, y, w, h;
+
+			if(content_box(img, op->args[0] / 100, &x, &y, &w, &h))
+				image_crop(img, x, y, w, h);
+
+			break;
+		}
+		case OP_BORDER:
+			image_border(img, lround(op->args[0] * img->width / 100), lround(op->args[0] * img->height / 100));
+			break;
+		case OP_BINARIZE:
+			if(img->bilevel)
+				break;
+
+			if(op->otsu)
+				binarize_otsu(img);
+			else
+				binarize_sauvola(img, (unsigned)op->args[0], op->args[1]);
+
+			break;
+		case OP_DESKEW:
+			res->angle = skew_angle(img, op->args[0]);
+
+			if(fabs(res->angle) >= op->args[1])
+			{
+				image_rotate(img, -res->angle);
+				res->deskewed = true;
+			}
+
+			break;
+	}
+}
+
+static
+int run_job(void* const ctx, const size_t i, const unsigned UNUSED(worker))
+{
+	const prep_state* const st = ctx;
+	const str file = st->files->strings[i];
+	const unsigned page = page_no(file, str_lit("pgm"));
+	prep_result* const res = &st->results[i];
+
+	image img;
+
+	image_load(&img, str_ptr(file));
+
+	for(unsigned k = 0; k < st->cmd->num_ops; ++k)
+		apply(&st->cmd->ops[k], &img, res, page);
+
+	image_save(&img, str_ptr(file));
+
+	res->width = img.width;
+	res->height = img.height;
+
+	image_free(&img);
+
+	return 0;
+}
+
+static
+void job_done(void* const ctx, const size_t i, const int status)
+{
+	const prep_state* const st = ctx;
+
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		return;
+
+	const unsigned page = page_no(st->files->strings[i], str_lit("pgm"));
+	const prep_result* const res = &st->results[i];
+	bool deskew = false;
+
+	for(unsigned k = 0; k < st->cmd->num_ops; ++k)
+		deskew |= (st->cmd->ops[k].kind == OP_DESKEW);
+
+	if(deskew)
+		info("page %u: done, %ux%u, skew %.2f degrees, %s", page, res->width, res->height, res->angle,
+			 res->deskewed ? "corrected" : "unchanged");
+	else
+		info("page %u: done, %ux%u", page, res->width, res->height);
+}
+
+int main(int argc, char* argv[])
+{
+	// command line options
+	command cmd;
+
+	parse_options(&cmd, argc, argv);
+
+	// make sure stdin is closed on exec
+	just(fcntl(STDIN_FILENO, F_SETFD, fcntl(STDIN_FILENO, F_GETFD) | FD_CLOEXEC));
+
+	// get file list
+	str_list* const files = list_files(cmd.dir, cmd.spec, "pgm");
+
+	if(str_list_is_empty(files))
+	{
+		if(cmd.fail_on_empty)
+			error(2, 0, "no pages found");
+
+		return 0;
+	}
+
+	// validate images
+	mem_free(pgm_check_files(files));
+
+	// process pages
+	prep_state st =
+	{
+		.cmd = &cmd,
+		.files = files,
+		.results = shared_alloc(files->len * sizeof(prep_result))
+	};
+
+	const job_runner runner = { .run = run_job, .done = job_done, .ctx = &st };
+	const int status = run_jobs(&runner, files->len, cmd.jobs);
+
+	if(status != 0)
+		check_exit_status(status);
+
+	return 0;
+}
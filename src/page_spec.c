@@ -41,7 +41,7 @@ void die_bad_spec(const char* const s)
 static
 const char* other_digits(const char* s, unsigned* const p)
 {
-	for(const char* const base = s; (s - base) < 3; ++s)
+	for(const char* const base = s; (s - base) < MAX_PAGE_DIGITS - 1; ++s)
 	{
 		const char c = *s;
 
@@ -8,8 +8,9 @@ typedef struct
 	unsigned first, last;
 } page_range;
 
-// max. page number
-#define MAX_PAGE_NO 9999
+// max. page number, and the max. number of digits in it
+#define MAX_PAGE_NO 999999
+#define MAX_PAGE_DIGITS 6
 
 // page specification
 typedef struct
@@ -0,0 +1,365 @@
+#include "pgm.h"
+#include "list_pages.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// header parser
+static
+const unsigned char* skip_space(const unsigned char* s, const unsigned char* const end)
+{
+	while(s < end)
+	{
+		switch(*s)
+		{
+			case ' ': case '\t': case '\r': case '\n': case '\v': case '\f':
+				++s;
+				break;
+			case '#':
+				while(s < end && *s != '\n')
+					++s;
+
+				break;
+			default:
+				return s;
+		}
+	}
+
+	return s;
+}
+
+static
+const unsigned char* read_uint(const unsigned char* s,
+							   const unsigned char* const end,
+							   unsigned* const pval)
+{
+	s = skip_space(s, end);
+
+	if(s == end || *s < '0' || *s > '9')
+		return NULL;
+
+	unsigned long val = 0;
+
+	do
+	{
+		if((val = val * 10 + *s++ - '0') > 0xFFFFFF)
+			return NULL;
+	} while(s < end && *s >= '0' && *s <= '9');
+
+	*pval = val;
+	return s;
+}
+
+static
+const char* parse_header(pgm_image* const img)
+{
+	const unsigned char* s = img->map;
+	const unsigned char* const end = s + img->map_size;
+
+	if(img->map_size < 2 || s[0] != 'P' || (s[1] != '5' && s[1] != '4'))
+		return "not a PGM or PBM image";
+
+	img->packed = (s[1] == '4');
+
+	if(!(s = read_uint(s + 2, end, &img->width))
+	   || !(s = read_uint(s, end, &img->height))
+	   || (img->packed ? !(img->maxval = 1) : !(s = read_uint(s, end, &img->maxval)))
+	   || s == end || !isspace(*s))
+		return "invalid PGM header";
+
+	if(img->width == 0 || img->height == 0 || img->maxval == 0 || img->maxval > 0xFFFF)
+		return "invalid PGM header";
+
+	// exactly one whitespace character before the raster
+	img->pixels = s + 1;
+
+	const size_t size = pgm_raster_size(img), avail = end - img->pixels;
+
+	if(avail < size)
+	{
+		static char msg[100];
+
+		snprintf(msg, sizeof(msg), "truncated PGM image (%zu of %zu bytes)", avail, size);
+		return msg;
+	}
+
+	return NULL;
+}
+
+const char* pgm_try_map(pgm_image* const img, const char* const name)
+{
+	*img = (pgm_image){0};
+
+	const int fd = open(name, O_RDONLY | O_CLOEXEC);
+
+	if(fd < 0)
+		return "cannot open file";
+
+	struct stat info;
+
+	if(fstat(fd, &info) < 0)
+	{
+		const int err = errno;
+
+		close(fd);
+		errno = err;
+		return "cannot stat file";
+	}
+
+	const char* msg = NULL;
+
+	if(!S_ISREG(info.st_mode))
+		msg = "not a regular file";
+	else if(info.st_size == 0)
+		msg = "empty file";
+
+	if(msg)
+	{
+		close(fd);
+		errno = 0;
+		return msg;
+	}
+
+	img->map_size = info.st_size;
+	img->map = mmap(NULL, img->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	const int err = errno;
+
+	close(fd);
+
+	if(img->map == MAP_FAILED)
+	{
+		*img = (pgm_image){0};
+		errno = err;
+		return "cannot map file to memory";
+	}
+
+	if((msg = parse_header(img)))
+	{
+		pgm_unmap(img);
+		errno = 0;
+	}
+
+	return msg;
+}
+
+void pgm_map(pgm_image* const img, const char* const name)
+{
+	const char* const msg = pgm_try_map(img, name);
+
+	if(msg)
+		die(errno, "%s: \"%s\"", msg, name);
+
+	madvise(img->map, img->map_size, MADV_SEQUENTIAL);
+}
+
+pgm_info* pgm_check_files(const str_list* const files)
+{
+	const size_t n = str_list_len(files);
+	pgm_info* const info = mem_alloc(max(n, (size_t)1) * sizeof(pgm_info));
+	size_t num_bad = 0;
+
+	for(size_t i = 0; i < n; ++i)
+	{
+		const char* const name = str_ptr(files->strings[i]);
+		const uint64_t t = trace_time();
+		pgm_image img;
+		const char* const msg = pgm_try_map(&img, name);
+
+		if(msg)
+		{
+			error(0, errno, "%s: \"%s\"", msg, name);
+			info[i] = (pgm_info){0};
+			++num_bad;
+			continue;
+		}
+
+		info[i] = pgm_get_info(&img);
+
+		pgm_unmap(&img);
+		trace_span("validate", 0, page_no(files->strings[i], str_lit("pgm")), t);
+	}
+
+	if(num_bad > 0)
+		die(0, "invalid page images: %zu of %zu", num_bad, n);
+
+	return info;
+}
+
+void pgm_unmap(pgm_image* const img)
+{
+	if(img->map)
+		just(munmap(img->map, img->map_size));
+
+	*img = (pgm_image){0};
+}
+
+void pgm_write_region(const pgm_image* const img, const pgm_region* const region, const char* const name)
+{
+	FILE* const stream = fopen(name, "we");
+
+	if(!stream)
+		die(errno, "cannot create file \"%s\"", name);
+
+	const size_t stride = pgm_row_size(img);
+	const unsigned char* row = img->pixels + region->y * stride;
+
+	if(img->packed)
+	{
+		just(fprintf(stream, "P4\n%u %u\n", region->width, region->height));
+
+		// rows are shifted left by the bit offset of the region
+		const size_t len = (region->width + 7) / 8, first = region->x / 8;
+		const unsigned shift = region->x % 8;
+		const unsigned char mask = 0xFF << ((8 - region->width % 8) % 8);
+		unsigned char* const buff = mem_alloc(len);
+
+		for(unsigned i = 0; i < region->height; ++i, row += stride)
+		{
+			for(size_t j = 0; j < len; ++j)
+			{
+				const size_t k = first + j;
+				const unsigned next = (k + 1 < stride) ? row[k + 1] : 0;
+
+				buff[j] = (row[k] << shift) | (next >> (8 - shift));
+			}
+
+			buff[len - 1] &= mask;
+
+			if(fwrite(buff, 1, len, stream) != len)
+				die(errno, "error writing file \"%s\"", name);
+		}
+
+		mem_free(buff);
+	}
+	else
+	{
+		just(fprintf(stream, "P5\n%u %u\n%u\n", region->width, region->height, img->maxval));
+
+		const size_t bpp = (img->maxval < 256) ? 1 : 2, len = bpp * region->width;
+
+		for(unsigned i = 0; i < region->height; ++i, row += stride)
+			if(fwrite(row + region->x * bpp, 1, len, stream) != len)
+				die(errno, "error writing file \"%s\"", name);
+	}
+
+	if(fclose(stream) != 0)
+		die(errno, "error writing file \"%s\"", name);
+}
+
+// dark pixel counters
+typedef uint8_t u8x16 __attribute__((vector_size(16)));
+
+static
+size_t count_dark_8(const unsigned char* p, size_t n, const unsigned char level)
+{
+	const u8x16 lv = (u8x16){0} + level;
+	size_t count = 0;
+
+	while(n >= sizeof(u8x16))
+	{
+		// each comparison yields 0 or 0xFF, so at most 255 rounds before the lanes overflow
+		const size_t rounds = min(n / sizeof(u8x16), (size_t)255);
+		u8x16 acc = {0};
+
+		for(size_t i = 0; i < rounds; ++i, p += sizeof(u8x16))
+		{
+			u8x16 v;
+
+			memcpy(&v, p, sizeof(v));
+			acc -= (u8x16)(v < lv);
+		}
+
+		for(size_t i = 0; i < sizeof(u8x16); ++i)
+			count += acc[i];
+
+		n -= rounds * sizeof(u8x16);
+	}
+
+	while(n-- > 0)
+		count += (*p++ < level);
+
+	return count;
+}
+
+static
+size_t count_dark_16(const unsigned char* p, size_t n, const unsigned level)
+{
+	size_t count = 0;
+
+	for(; n > 0; --n, p += 2)
+		count += ((unsigned)(p[0] << 8 | p[1]) < level);
+
+	return count;
+}
+
+static
+size_t count_black_row(const pgm_image* const img, const unsigned char* const row)
+{
+	const size_t stride = pgm_row_size(img);
+	const unsigned char mask = 0xFF << ((8 - img->width % 8) % 8);
+	size_t count = 0, i = 0;
+
+	for(; i + sizeof(uint64_t) < stride; i += sizeof(uint64_t))
+	{
+		uint64_t v;
+
+		memcpy(&v, row + i, sizeof(v));
+		count += __builtin_popcountll(v);
+	}
+
+	for(; i < stride - 1; ++i)
+		count += __builtin_popcount(row[i]);
+
+	// padding bits are ignored
+	return count + __builtin_popcount(row[stride - 1] & mask);
+}
+
+static
+size_t count_black_bits(const pgm_image* const img)
+{
+	const size_t stride = pgm_row_size(img);
+	const unsigned char* row = img->pixels;
+	size_t count = 0;
+
+	for(unsigned y = 0; y < img->height; ++y, row += stride)
+		count += count_black_row(img, row);
+
+	return count;
+}
+
+double pgm_ink_ratio(const pgm_image* const img)
+{
+	const size_t n = (size_t)img->width * img->height;
+	const unsigned level = (img->maxval + 1) / 2;
+
+	const size_t count = img->packed ? count_black_bits(img)
+					   : (img->maxval < 256) ? count_dark_8(img->pixels, n, level)
+					   : count_dark_16(img->pixels, n, level);
+
+	return (double)count / n;
+}
+
+double pgm_ink_estimate(const pgm_image* const img, const unsigned step)
+{
+	const size_t stride = pgm_row_size(img);
+	const unsigned level = (img->maxval + 1) / 2;
+	size_t count = 0, num_rows = 0;
+
+	for(unsigned y = min(step / 2, img->height - 1); y < img->height; y += step, ++num_rows)
+	{
+		const unsigned char* const row = img->pixels + y * stride;
+
+		count += img->packed ? count_black_row(img, row)
+			   : (img->maxval < 256) ? count_dark_8(row, img->width, level)
+			   : count_dark_16(row, img->width, level);
+	}
+
+	return (double)count / ((size_t)img->width * num_rows);
+}
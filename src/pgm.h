@@ -0,0 +1,71 @@
+#pragma once
+
+#include "utils.h"
+
+// memory-mapped image in PGM format, or in bilevel PBM format
+typedef struct
+{
+	void* map;
+	size_t map_size;
+	const unsigned char* pixels;
+	unsigned width, height, maxval;
+	bool packed;	// PBM: 8 pixels per byte, bit 1 is black, maxval is 1
+} pgm_image;
+
+// size of one row of the image raster in bytes
+static inline
+size_t pgm_row_size(const pgm_image* const img)
+{
+	if(img->packed)
+		return (img->width + 7) / 8;
+
+	return (size_t)img->width * ((img->maxval < 256) ? 1 : 2);
+}
+
+// size of the image raster in bytes
+static inline
+size_t pgm_raster_size(const pgm_image* const img)
+{
+	return pgm_row_size(img) * img->height;
+}
+
+// map the given file to memory; on error, returns a message describing the problem,
+// with errno set to the error code, or to 0 if the file content is invalid
+const char* pgm_try_map(pgm_image* const img, const char* const name);
+
+// map the given file to memory, or terminate the program on error
+void pgm_map(pgm_image* const img, const char* const name);
+
+// release the mapping
+void pgm_unmap(pgm_image* const img);
+
+// image header info
+typedef struct
+{
+	unsigned width, height, depth;	// depth in bits per pixel
+} pgm_info;
+
+static inline
+pgm_info pgm_get_info(const pgm_image* const img)
+{
+	return (pgm_info){ img->width, img->height, img->packed ? 1 : (img->maxval < 256) ? 8 : 16 };
+}
+
+// validate all the given image files and return their header info; all invalid
+// files are reported before the program terminates
+pgm_info* pgm_check_files(const str_list* const files);
+
+// rectangular part of an image
+typedef struct
+{
+	unsigned x, y, width, height;
+} pgm_region;
+
+// write the given region of the image to a new file in the same format
+void pgm_write_region(const pgm_image* const img, const pgm_region* const region, const char* const name);
+
+// fraction of dark pixels in the image, from 0 to 1
+double pgm_ink_ratio(const pgm_image* const img);
+
+// estimate of pgm_ink_ratio() from every step-th row of the image, reading only those rows
+double pgm_ink_estimate(const pgm_image* const img, const unsigned step);
@@ -0,0 +1,421 @@
+#include "ram_store.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+// tmpfs directory for the stores
+#define RAM_STORE_ROOT "/dev/shm"
+
+// file with the memory cap, in the store directory
+#define CAP_FILE ".cap"
+
+// format a path name
+static __attribute__((format(printf, 2, 3)))
+void make_path(char* const buff, const char* const fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+
+	const int n = vsnprintf(buff, PATH_MAX, fmt, args);
+
+	va_end(args);
+
+	if(n < 0 || n >= PATH_MAX)
+		die(0, "path name is too long");
+}
+
+static
+void write_cap(const char* const dir, const uint64_t cap)
+{
+	char name[PATH_MAX];
+
+	make_path(name, "%s/" CAP_FILE, dir);
+
+	FILE* const out = fopen(name, "we");
+
+	if(!out)
+		die(errno, "cannot create file \"%s\"", name);
+
+	if(fprintf(out, "%" PRIu64 "\n", cap) < 0 || fclose(out) != 0)
+		die(errno, "error writing file \"%s\"", name);
+}
+
+static
+uint64_t read_cap(const char* const dir)
+{
+	char name[PATH_MAX];
+
+	make_path(name, "%s/" CAP_FILE, dir);
+
+	FILE* const in = fopen(name, "re");
+
+	if(!in)
+		die(errno, "cannot open file \"%s\"", name);
+
+	uint64_t cap;
+
+	if(fscanf(in, "%" SCNu64, &cap) != 1 || cap == 0)
+		die(0, "invalid memory cap in file \"%s\"", name);
+
+	just(fclose(in));
+
+	return cap;
+}
+
+bool ram_store_open(ram_store* const s, const char* const project, const uint64_t cap)
+{
+	*s = (ram_store){ .cap = cap };
+
+	just(asprintf(&s->project, "%s", project));
+	just(asprintf(&s->dir, "%s/" RAM_STORE_DIR, project));
+
+	struct stat info;
+
+	if(stat(s->dir, &info) == 0)
+	{
+		if(!S_ISDIR(info.st_mode))
+			die(0, "\"%s\" is not a directory", s->dir);
+
+		if(cap > 0)
+			write_cap(s->dir, cap);
+		else
+			s->cap = read_cap(s->dir);
+
+		return true;
+	}
+
+	if(errno != ENOENT)
+		die(errno, "cannot stat \"%s\"", s->dir);
+
+	// a link left dangling by a reboot; the pages it held are gone
+	if(lstat(s->dir, &info) == 0 && unlink(s->dir) != 0 && errno != ENOENT)
+		die(errno, "cannot remove \"%s\"", s->dir);
+
+	if(cap == 0)
+	{
+		ram_store_close(s);
+		return false;
+	}
+
+	// new store
+	char tmp[] = RAM_STORE_ROOT "/ocr-XXXXXX";
+
+	if(!mkdtemp(tmp))
+		die(errno, "cannot create directory in \"" RAM_STORE_ROOT "\"");
+
+	just(chmod(tmp, 0755));
+	write_cap(tmp, cap);
+
+	if(symlink(tmp, s->dir) == 0)
+		return true;
+
+	if(errno != EEXIST)
+		die(errno, "cannot create link \"%s\"", s->dir);
+
+	// another process has been faster
+	char name[PATH_MAX];
+
+	make_path(name, "%s/" CAP_FILE, tmp);
+	unlink(name);
+	rmdir(tmp);
+	write_cap(s->dir, cap);
+
+	return true;
+}
+
+void ram_store_close(ram_store* const s)
+{
+	free(s->project);
+	free(s->dir);
+
+	*s = (ram_store){ .cap = 0 };
+}
+
+// page number from the page file name, like "page-0012.pgm"
+static
+bool page_of(const char* const name, unsigned* const page)
+{
+	if(strncmp(name, "page-", 5) != 0)
+		return false;
+
+	const char* s = name + 5;
+	unsigned n = 0, num_digits = 0;
+
+	for(; *s >= '0' && *s <= '9' && num_digits <= MAX_PAGE_DIGITS; ++s, ++num_digits)
+		n = 10 * n + *s - '0';
+
+	if(num_digits == 0 || num_digits > MAX_PAGE_DIGITS || *s != '.' || s[1] == 0)
+		return false;
+
+	for(++s; *s >= 'a' && *s <= 'z'; ++s);
+
+	*page = n;
+	return *s == 0;
+}
+
+// shard directory name: digits only
+static
+bool is_shard_dir(const char* const name)
+{
+	const char* s = name;
+
+	for(; *s >= '0' && *s <= '9'; ++s);
+
+	return s > name && *s == 0;
+}
+
+// page file in the store
+typedef struct
+{
+	char* name;		// relative to the store
+	unsigned page;
+	struct timespec used;
+} store_file;
+
+// list the page files in the store directory and its shard subdirectories, and sum up
+// the sizes of all the files
+static
+void scan_dir(const char* const root, const char* const rel, store_file** const files, size_t* const num_files,
+			  uint64_t* const total)
+{
+	char name[PATH_MAX];
+
+	if(rel)
+		make_path(name, "%s/%s", root, rel);
+	else
+		make_path(name, "%s", root);
+
+	DIR* const dir = opendir(name);
+
+	if(!dir)
+		die(errno, "cannot open directory \"%s\"", name);
+
+	for(const struct dirent* ent = readdir(dir); ent; ent = readdir(dir))
+	{
+		if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+			continue;
+
+		struct stat info;
+
+		if(fstatat(dirfd(dir), ent->d_name, &info, AT_SYMLINK_NOFOLLOW) != 0)
+			continue;	// gone meanwhile
+
+		if(S_ISDIR(info.st_mode))
+		{
+			if(!rel && is_shard_dir(ent->d_name))
+				scan_dir(root, ent->d_name, files, num_files, total);
+
+			continue;
+		}
+
+		*total += info.st_size;
+
+		unsigned page;
+
+		if(!S_ISREG(info.st_mode) || !page_of(ent->d_name, &page))
+			continue;
+
+		// least recently used: the later of the last read and the last write
+		store_file f = { .page = page, .used = info.st_mtim };
+
+		if(info.st_atim.tv_sec > f.used.tv_sec
+		   || (info.st_atim.tv_sec == f.used.tv_sec && info.st_atim.tv_nsec > f.used.tv_nsec))
+			f.used = info.st_atim;
+
+		if(rel)
+			just(asprintf(&f.name, "%s/%s", rel, ent->d_name));
+		else
+			just(asprintf(&f.name, "%s", ent->d_name));
+
+		*files = mem_realloc(*files, (*num_files + 1) * sizeof(store_file));
+		(*files)[(*num_files)++] = f;
+	}
+
+	closedir(dir);
+}
+
+static
+int cmp_files(const void* const a, const void* const b)
+{
+	const store_file* const x = a;
+	const store_file* const y = b;
+
+	if(x->used.tv_sec != y->used.tv_sec)
+		return (x->used.tv_sec > y->used.tv_sec) - (x->used.tv_sec < y->used.tv_sec);
+
+	return (x->used.tv_nsec > y->used.tv_nsec) - (x->used.tv_nsec < y->used.tv_nsec);
+}
+
+// move the page file from the store to the project directory; returns the size moved,
+// or 0 if the file is gone, or has been replaced while being copied
+static
+uint64_t spill(const ram_store* const s, const char* const rel)
+{
+	char from[PATH_MAX], to[PATH_MAX], tmp[PATH_MAX];
+
+	make_path(from, "%s/%s", s->dir, rel);
+	make_path(to, "%s/%s", s->project, rel);
+	make_path(tmp, "%s.XXXXXX", to);
+
+	const int in = open(from, O_RDONLY | O_CLOEXEC);
+
+	if(in < 0)
+	{
+		if(errno == ENOENT)
+			return 0;
+
+		die(errno, "cannot open file \"%s\"", from);
+	}
+
+	struct stat info;
+
+	just(fstat(in, &info));
+
+	// shard directory
+	const char* const slash = strrchr(rel, '/');
+
+	if(slash)
+	{
+		char dir[PATH_MAX];
+
+		make_path(dir, "%s/%.*s", s->project, (int)(slash - rel), rel);
+
+		if(mkdir(dir, 0755) != 0 && errno != EEXIST)
+			die(errno, "cannot create directory \"%s\"", dir);
+	}
+
+	// copy under a temporary name, keeping the times for the tools checking them
+	const int out = mkostemp(tmp, O_CLOEXEC);
+
+	if(out < 0)
+		die(errno, "cannot create file \"%s\"", tmp);
+
+	for(off_t off = 0; off < info.st_size;)
+	{
+		const ssize_t n = sendfile(out, in, &off, info.st_size - off);
+
+		if(n < 0)
+			die(errno, "cannot copy file \"%s\" to \"%s\"", from, tmp);
+
+		if(n == 0)
+			break;
+	}
+
+	just(fchmod(out, info.st_mode & 0777));
+	just(futimens(out, (const struct timespec[2]){ info.st_atim, info.st_mtim }));
+
+	if(close(out) != 0)
+		die(errno, "error writing file \"%s\"", tmp);
+
+	just(close(in));
+
+	// the image tools replace the pages by renaming
+	struct stat now;
+
+	if(stat(from, &now) != 0 || now.st_ino != info.st_ino
+	   || now.st_mtim.tv_sec != info.st_mtim.tv_sec || now.st_mtim.tv_nsec != info.st_mtim.tv_nsec)
+	{
+		unlink(tmp);
+		return 0;
+	}
+
+	if(rename(tmp, to) != 0)
+		die(errno, "cannot rename \"%s\" to \"%s\"", tmp, to);
+
+	if(unlink(from) != 0 && errno != ENOENT)
+		die(errno, "cannot remove file \"%s\"", from);
+
+	return max(info.st_size, (off_t)1);
+}
+
+// move the least recently used pages to the project directory, while the store is over
+// the limit; returns the number of pages moved
+static
+size_t trim(const ram_store* const s, const uint64_t limit, bool (*busy)(void* ctx, unsigned page), void* const ctx)
+{
+	store_file* files = NULL;
+	size_t num_files = 0, num_moved = 0;
+	uint64_t total = 0;
+
+	scan_dir(s->dir, NULL, &files, &num_files, &total);
+	qsort(files, num_files, sizeof(store_file), cmp_files);
+
+	for(size_t i = 0; i < num_files; ++i)
+	{
+		if(total > limit && !(busy && busy(ctx, files[i].page)))
+		{
+			const uint64_t size = spill(s, files[i].name);
+
+			total -= min(size, total);
+			num_moved += (size > 0);
+		}
+
+		free(files[i].name);
+	}
+
+	mem_free(files);
+
+	return num_moved;
+}
+
+size_t ram_store_trim(const ram_store* const s, bool (*busy)(void* ctx, unsigned page), void* const ctx)
+{
+	return trim(s, s->cap, busy, ctx);
+}
+
+// remove the directory with all the files in it, and its subdirectories with the files
+// in them
+static
+void remove_dir(const char* const name, const bool recurse)
+{
+	DIR* const dir = opendir(name);
+
+	if(dir)
+	{
+		for(const struct dirent* ent = readdir(dir); ent; ent = readdir(dir))
+		{
+			if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+				continue;
+
+			if(unlinkat(dirfd(dir), ent->d_name, 0) != 0 && errno == EISDIR && recurse)
+			{
+				char sub[PATH_MAX];
+
+				make_path(sub, "%s/%s", name, ent->d_name);
+				remove_dir(sub, false);
+			}
+		}
+
+		closedir(dir);
+	}
+
+	if(rmdir(name) != 0 && errno != ENOENT)
+		die(errno, "cannot remove directory \"%s\"", name);
+}
+
+void ram_store_remove(ram_store* const s)
+{
+	trim(s, 0, NULL, NULL);
+
+	// what is left are temporary files
+	char* const dir = realpath(s->dir, NULL);
+
+	if(!dir)
+		die(errno, "cannot resolve \"%s\"", s->dir);
+
+	remove_dir(dir, true);
+	free(dir);
+
+	if(unlink(s->dir) != 0 && errno != ENOENT)
+		die(errno, "cannot remove \"%s\"", s->dir);
+
+	ram_store_close(s);
+}
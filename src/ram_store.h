@@ -0,0 +1,32 @@
+#pragma once
+
+#include "utils.h"
+#include "list_pages.h"
+
+#include <stdint.h>
+
+// store of the page images in memory: a directory on tmpfs, linked from the project
+// directory as RAM_STORE_DIR, with the same layout as the project directory. The store
+// is kept within its memory cap by moving the least recently used pages to the project
+// directory, under the same names relative to it.
+typedef struct
+{
+	char* project;	// project directory
+	char* dir;		// store directory, through the link
+	uint64_t cap;	// memory cap, in bytes
+} ram_store;
+
+// open the RAM store of the project directory, creating it if not present, and set its
+// memory cap; with cap 0, only an existing store is opened, with the cap it was given.
+// Returns false if there is no store.
+bool ram_store_open(ram_store* const s, const char* const project, const uint64_t cap);
+
+void ram_store_close(ram_store* const s);
+
+// move the least recently used pages to the project directory until the store is within
+// its cap; the pages for which busy() returns true (if given) are left in place. Returns
+// the number of pages moved.
+size_t ram_store_trim(const ram_store* const s, bool (*busy)(void* ctx, unsigned page), void* const ctx);
+
+// move all the pages to the project directory, and remove the store
+void ram_store_remove(ram_store* const s);
@@ -0,0 +1,279 @@
+#include "render_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// record file name, relative to the project directory; the file has the lines
+//	source	INODE	SIZE	MTIME	MTIME_NS	HASH	- the content hash of an input file
+//	page	N	HASH	PARAMS						- page N rendered from the source with the given hash
+#define CACHE_FILE ".ocr-open"
+
+struct source_entry
+{
+	uint64_t ino, size, sec, nsec, hash;
+	size_t seq;
+};
+
+struct page_entry
+{
+	unsigned page;
+	uint64_t hash, params;	// source hash, and the hash of the rendering parameters
+	size_t seq;
+};
+
+// hash of the rendering parameters
+static
+uint64_t params_hash(const char* s)
+{
+	uint64_t h = 0xcbf29ce484222325;
+
+	while(*s)
+		h = (h ^ (unsigned char)*s++) * 0x100000001b3;
+
+	return h;
+}
+
+// hash of the whole file content, for change detection only
+static
+uint64_t file_hash(const int fd, const char* const fname, const size_t size)
+{
+	uint64_t h = 0x9e3779b97f4a7c15 ^ size;
+
+	if(size == 0)
+		return h;
+
+	const unsigned char* const p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if(p == MAP_FAILED)
+		die(errno, "cannot map file \"%s\"", fname);
+
+	just(madvise((void*)p, size, MADV_SEQUENTIAL));
+
+	size_t i = 0;
+
+	for(; i + 8 <= size; i += 8)
+	{
+		uint64_t w;
+
+		memcpy(&w, p + i, sizeof(w));
+
+		h = (h ^ w) * 0xff51afd7ed558ccd;
+		h ^= h >> 32;
+	}
+
+	uint64_t w = 0;
+
+	memcpy(&w, p + i, size - i);
+
+	h = (h ^ w) * 0xc4ceb9fe1a85ec53;
+	h ^= h >> 29;
+
+	munmap((void*)p, size);
+
+	return h;
+}
+
+#define CMP(a, b)	(((a) > (b)) - ((a) < (b)))
+
+static
+int cmp_sources(const void* const a, const void* const b)
+{
+	const struct source_entry* const x = a;
+	const struct source_entry* const y = b;
+
+	if(x->ino != y->ino)
+		return CMP(x->ino, y->ino);
+
+	if(x->size != y->size)
+		return CMP(x->size, y->size);
+
+	if(x->sec != y->sec)
+		return CMP(x->sec, y->sec);
+
+	return CMP(x->nsec, y->nsec);
+}
+
+static
+int cmp_pages(const void* const a, const void* const b)
+{
+	return CMP(((const struct page_entry*)a)->page, ((const struct page_entry*)b)->page);
+}
+
+// the same, with the latest entry last
+static
+int cmp_seq_sources(const void* const a, const void* const b)
+{
+	const int ret = cmp_sources(a, b);
+
+	return ret ? ret : CMP(((const struct source_entry*)a)->seq, ((const struct source_entry*)b)->seq);
+}
+
+static
+int cmp_seq_pages(const void* const a, const void* const b)
+{
+	const int ret = cmp_pages(a, b);
+
+	return ret ? ret : CMP(((const struct page_entry*)a)->seq, ((const struct page_entry*)b)->seq);
+}
+
+// sort the entries, and keep the latest one for every key
+static
+size_t sort_unique(void* const base, const size_t n, const size_t size,
+				   int (*cmp_seq)(const void*, const void*),
+				   int (*cmp)(const void*, const void*))
+{
+	qsort(base, n, size, cmp_seq);
+
+	char* const p = base;
+	size_t len = 0;
+
+	for(size_t i = 0; i < n; ++i)
+		if(i + 1 == n || cmp(p + i * size, p + (i + 1) * size) != 0)
+			memmove(p + len++ * size, p + i * size, size);
+
+	return len;
+}
+
+// append a line
+static
+void write_line(const render_cache* const c, const char* const line, const int n)
+{
+	// one write(2) per line, so that an interrupted run leaves at most one partial line
+	if(n < 0 || write(c->fd, line, n) != n)
+		die(errno, "error writing file \"%s\"", c->name);
+}
+
+void render_cache_open(render_cache* const c, const char* const dir)
+{
+	*c = (render_cache){ .fd = -1 };
+
+	just(asprintf(&c->name, "%s/" CACHE_FILE, dir));
+
+	if((c->fd = open(c->name, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0)
+		die(errno, "cannot open file \"%s\"", c->name);
+
+	FILE* const stream = fdopen(dup(c->fd), "r");
+
+	if(!stream)
+		die(errno, "cannot read file \"%s\"", c->name);
+
+	char* line = NULL;
+	size_t cap = 0, src_cap = 0, page_cap = 0, seq = 0;
+	ssize_t len;
+
+	while((len = getline(&line, &cap, stream)) >= 0)
+	{
+		if(len == 0 || line[len - 1] != '\n')
+			continue;	// cut short by a crash
+
+		line[len - 1] = 0;
+
+		struct source_entry s = { .seq = seq++ };
+		struct page_entry p = { .seq = s.seq };
+		int n = 0;
+
+		if(sscanf(line, "source\t%" SCNu64 "\t%" SCNu64 "\t%" SCNu64 "\t%" SCNu64 "\t%" SCNx64,
+				  &s.ino, &s.size, &s.sec, &s.nsec, &s.hash) == 5)
+		{
+			if(c->num_sources == src_cap)
+				c->sources = mem_realloc(c->sources, (src_cap = src_cap ? 2 * src_cap : 64) * sizeof(s));
+
+			c->sources[c->num_sources++] = s;
+		}
+		else if(sscanf(line, "page\t%u\t%" SCNx64 "\t%n", &p.page, &p.hash, &n) == 2 && n > 0)
+		{
+			p.params = params_hash(line + n);
+
+			if(c->num_pages == page_cap)
+				c->pages = mem_realloc(c->pages, (page_cap = page_cap ? 2 * page_cap : 256) * sizeof(p));
+
+			c->pages[c->num_pages++] = p;
+		}
+	}
+
+	if(ferror(stream))
+		die(errno, "error reading file \"%s\"", c->name);
+
+	free(line);
+	just(fclose(stream));
+
+	c->num_sources = sort_unique(c->sources, c->num_sources, sizeof(struct source_entry), cmp_seq_sources, cmp_sources);
+	c->num_pages = sort_unique(c->pages, c->num_pages, sizeof(struct page_entry), cmp_seq_pages, cmp_pages);
+}
+
+void render_cache_close(render_cache* const c)
+{
+	if(c->fd >= 0)
+		just(close(c->fd));
+
+	free(c->name);
+	mem_free(c->sources);
+	mem_free(c->pages);
+
+	*c = (render_cache){ .fd = -1 };
+}
+
+uint64_t render_cache_file_hash(render_cache* const c, const char* const fname)
+{
+	const int fd = open(fname, O_RDONLY | O_CLOEXEC);
+
+	if(fd < 0)
+		die(errno, "cannot open file \"%s\"", fname);
+
+	struct stat info;
+
+	just(fstat(fd, &info));
+
+	struct source_entry key =
+	{
+		.ino = info.st_ino,
+		.size = info.st_size,
+		.sec = info.st_mtim.tv_sec,
+		.nsec = info.st_mtim.tv_nsec
+	};
+
+	const struct source_entry* const p = bsearch(&key, c->sources, c->num_sources, sizeof(key), cmp_sources);
+
+	if(p)
+		key.hash = p->hash;
+	else
+	{
+		key.hash = file_hash(fd, fname, info.st_size);
+
+		char line[200];
+
+		write_line(c, line, snprintf(line, sizeof(line),
+									 "source\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%016" PRIx64 "\n",
+									 key.ino, key.size, key.sec, key.nsec, key.hash));
+	}
+
+	just(close(fd));
+
+	return key.hash;
+}
+
+bool render_cache_has(const render_cache* const c, const unsigned page, const uint64_t hash,
+					  const char* const params)
+{
+	const struct page_entry key = { .page = page };
+	const struct page_entry* const p = bsearch(&key, c->pages, c->num_pages, sizeof(key), cmp_pages);
+
+	return p && p->hash == hash && p->params == params_hash(params);
+}
+
+void render_cache_add(const render_cache* const c, const unsigned page, const uint64_t hash,
+					  const char* const params)
+{
+	char* line;
+	const int n = asprintf(&line, "page\t%u\t%016" PRIx64 "\t%s\n", page, hash, params);
+
+	if(n < 0)
+		die(ENOMEM, "internal error");
+
+	write_line(c, line, n);
+	free(line);
+}
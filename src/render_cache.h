@@ -0,0 +1,45 @@
+#pragma once
+
+#include "utils.h"
+
+#include <stdint.h>
+
+// record of the rendered pages in the project directory: for every page, the content hash
+// of its source and the rendering parameters; an append-only file where the latest entry
+// for a page wins
+typedef struct
+{
+	int fd;
+	char* name;
+	size_t num_sources, num_pages;
+	struct source_entry* sources;	// sorted by file identity
+	struct page_entry* pages;		// sorted by page number
+} render_cache;
+
+// open the record in the given directory, creating it if needed, and load its entries
+void render_cache_open(render_cache* const c, const char* const dir);
+
+// close the record
+void render_cache_close(render_cache* const c);
+
+// content hash of the given file; the hash is computed once per file identity (inode,
+// size and modification time), and recorded
+uint64_t render_cache_file_hash(render_cache* const c, const char* const fname);
+
+// check if the page has been rendered from the source with the given hash, with the given
+// parameters
+bool render_cache_has(const render_cache* const c, const unsigned page, const uint64_t hash,
+					  const char* const params);
+
+// record the rendered page
+void render_cache_add(const render_cache* const c, const unsigned page, const uint64_t hash,
+					  const char* const params);
+
+// combine two hashes
+static inline
+uint64_t hash_combine(const uint64_t a, const uint64_t b)
+{
+	const uint64_t h = (a ^ (b + 0x9e3779b97f4a7c15 + (a << 6) + (a >> 2))) * 0xff51afd7ed558ccd;
+
+	return h ^ (h >> 32);
+}
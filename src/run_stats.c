@@ -0,0 +1,178 @@
+#include "run_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+
+// record file name, relative to the project directory
+#define RUN_STATS_FILE ".ocr-stats"
+
+// default model of the tesseract memory: the program itself, the models of the languages,
+// and the copies of the image it keeps while recognising it
+#define RSS_BASE		(64ull << 20)
+#define RSS_PER_LANG	(48ull << 20)
+#define RSS_PER_PIXEL	12
+
+// default model of the tesseract time: the work grows with the image size, and much faster
+// with the amount of ink, that is, of the text to recognise; the time per unit of work is
+// per language
+#define INK_WEIGHT		20
+#define TIME_PER_UNIT	3e-7
+
+// language set with the largest ratio of the observed peak memory to the default model,
+// and the total work and time of its runs
+struct stats_entry
+{
+	char* langs;
+	double rss_scale;
+	double work, time;
+};
+
+static
+unsigned num_langs(const char* const langs)
+{
+	unsigned n = 1;
+
+	for(const char* s = langs; *s; ++s)
+		n += (*s == '+' || *s == '/');
+
+	return n;
+}
+
+static
+uint64_t default_rss(const char* const langs, const uint64_t pixels)
+{
+	return RSS_BASE + RSS_PER_LANG * num_langs(langs) + RSS_PER_PIXEL * pixels;
+}
+
+static
+double work_units(const uint64_t pixels, const double ink)
+{
+	return (double)pixels * (1 + INK_WEIGHT * ink);
+}
+
+static
+struct stats_entry* find_entry(const run_stats* const s, const char* const langs)
+{
+	for(size_t i = 0; i < s->len; ++i)
+		if(strcmp(s->entries[i].langs, langs) == 0)
+			return &s->entries[i];
+
+	return NULL;
+}
+
+static
+void add_entry(run_stats* const s, const char* const langs, const uint64_t pixels, const double ink,
+			   const uint64_t rss, const uint64_t msec)
+{
+	const double scale = (double)rss / default_rss(langs, pixels);
+	struct stats_entry* p = find_entry(s, langs);
+
+	if(!p)
+	{
+		s->entries = mem_realloc(s->entries, (s->len + 1) * sizeof(struct stats_entry));
+		p = &s->entries[s->len++];
+		*p = (struct stats_entry){ .langs = strdup(langs) };
+	}
+
+	p->rss_scale = max(p->rss_scale, scale);
+	p->work += work_units(pixels, ink);
+	p->time += msec / 1000.;
+}
+
+// load the entries: language set, image size in pixels, ink ratio, peak memory in kilobytes,
+// time in milliseconds, and time stamp, separated by tabs; malformed lines, like one cut
+// short by a crash, are skipped
+static
+void load_entries(run_stats* const s)
+{
+	FILE* const stream = fdopen(dup(s->fd), "r");
+
+	if(!stream)
+		die(errno, "cannot read file \"%s\"", s->name);
+
+	char* line = NULL;
+	size_t cap = 0;
+
+	while(getline(&line, &cap, stream) >= 0)
+	{
+		char langs[256];
+		unsigned long long pixels, rss_kb, msec, stamp;
+		double ink;
+		const size_t len = strlen(line);
+
+		if(len > 0 && line[len - 1] == '\n'
+			&& sscanf(line, "%255[^\t]\t%llu\t%lf\t%llu\t%llu\t%llu", langs, &pixels, &ink, &rss_kb, &msec, &stamp) == 6
+			&& rss_kb > 0 && ink >= 0 && ink <= 1)
+			add_entry(s, langs, pixels, ink, rss_kb << 10, msec);
+	}
+
+	if(ferror(stream))
+		die(errno, "error reading file \"%s\"", s->name);
+
+	mem_free(line);
+	just(fclose(stream));
+}
+
+void run_stats_open(run_stats* const s, const char* const dir)
+{
+	*s = (run_stats){ .fd = -1 };
+
+	just(asprintf(&s->name, "%s/" RUN_STATS_FILE, dir));
+
+	if((s->fd = open(s->name, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0)
+		die(errno, "cannot open file \"%s\"", s->name);
+
+	load_entries(s);
+}
+
+void run_stats_close(run_stats* const s)
+{
+	if(s->fd >= 0)
+		just(close(s->fd));
+
+	for(size_t i = 0; i < s->len; ++i)
+		free(s->entries[i].langs);
+
+	free(s->name);
+	mem_free(s->entries);
+
+	*s = (run_stats){ .fd = -1 };
+}
+
+uint64_t rss_estimate(const run_stats* const s, const char* const langs, const uint64_t pixels)
+{
+	const struct stats_entry* const p = find_entry(s, langs);
+
+	return p ? (uint64_t)(p->rss_scale * default_rss(langs, pixels)) : default_rss(langs, pixels);
+}
+
+double time_estimate(const run_stats* const s, const char* const langs, const uint64_t pixels, const double ink)
+{
+	const struct stats_entry* const p = find_entry(s, langs);
+	const double rate = (p && p->work > 0 && p->time > 0) ? p->time / p->work : TIME_PER_UNIT * num_langs(langs);
+
+	return rate * work_units(pixels, ink);
+}
+
+void run_stats_add(run_stats* const s, const char* const langs, const uint64_t pixels, const double ink,
+				   const uint64_t rss, const uint64_t msec)
+{
+	if(rss == 0)
+		return;
+
+	add_entry(s, langs, pixels, ink, rss, msec);
+
+	char line[400];
+
+	// one locked write(2) per line, so that the entries are never interleaved
+	const int n = snprintf(line, sizeof(line), "%s\t%llu\t%.4f\t%llu\t%llu\t%lld\n",
+						   langs, (unsigned long long)pixels, ink, (unsigned long long)(rss >> 10),
+						   (unsigned long long)msec, (long long)time(NULL));
+
+	if(n < 0 || n >= (int)sizeof(line))
+		return;
+
+	append_line(s->fd, s->name, line, n);
+}
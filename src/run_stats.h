@@ -0,0 +1,35 @@
+#pragma once
+
+#include "utils.h"
+
+#include <stdint.h>
+
+// record of the tesseract runs in the project directory: the peak resident memory and
+// the time taken per page, by language set, used to estimate the cost of the next runs;
+// an append-only file
+typedef struct
+{
+	int fd;
+	char* name;
+	size_t len;
+	struct stats_entry* entries;	// per language set
+} run_stats;
+
+// open the record in the given directory, creating it if needed, and load its entries
+void run_stats_open(run_stats* const s, const char* const dir);
+
+// close the record
+void run_stats_close(run_stats* const s);
+
+// estimated peak resident memory, in bytes, of recognising an image of the given size
+// with the given language set (like "rus+eng")
+uint64_t rss_estimate(const run_stats* const s, const char* const langs, const uint64_t pixels);
+
+// estimated time, in seconds, of recognising an image of the given size and ink ratio
+// (the fraction of dark pixels) with the given language set
+double time_estimate(const run_stats* const s, const char* const langs, const uint64_t pixels, const double ink);
+
+// record the peak resident memory, in bytes, and the time, in milliseconds, of recognising
+// an image of the given size and ink ratio
+void run_stats_add(run_stats* const s, const char* const langs, const uint64_t pixels, const double ink,
+				   const uint64_t rss, const uint64_t msec);
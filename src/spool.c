@@ -0,0 +1,568 @@
+#include "spool.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// spool directory name, relative to the project directory
+#define SPOOL_DIR ".ocr-spool"
+
+// heartbeat file name, relative to the claim directory of the worker
+#define HEARTBEAT_FILE ".heartbeat"
+
+// format a path name
+static __attribute__((format(printf, 2, 3)))
+void make_path(char* const buff, const char* const fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+
+	const int n = vsnprintf(buff, PATH_MAX, fmt, args);
+
+	va_end(args);
+
+	if(n < 0 || n >= PATH_MAX)
+		die(0, "path name is too long");
+}
+
+static
+void make_dir(const char* const name)
+{
+	if(mkdir(name, 0755) < 0 && errno != EEXIST)
+		die(errno, "cannot create directory \"%s\"", name);
+}
+
+// remove the directory with all the files in it
+static
+void remove_dir(const char* const name)
+{
+	DIR* const dir = opendir(name);
+
+	if(dir)
+	{
+		for(const struct dirent* ent = readdir(dir); ent; ent = readdir(dir))
+			if(strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+				unlinkat(dirfd(dir), ent->d_name, 0);
+
+		closedir(dir);
+	}
+
+	rmdir(name);
+}
+
+// remove the claim directories left by the workers gone, with their heartbeat files
+static
+void remove_claims(const char* const name)
+{
+	DIR* const dir = opendir(name);
+
+	if(dir)
+	{
+		char worker[PATH_MAX];
+
+		for(const struct dirent* ent = readdir(dir); ent; ent = readdir(dir))
+		{
+			if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+				continue;
+
+			make_path(worker, "%s/%s", name, ent->d_name);
+			remove_dir(worker);
+		}
+
+		closedir(dir);
+	}
+
+	rmdir(name);
+}
+
+// fill a new spool under a temporary name, then move it into place, unless another worker
+// has been faster
+static
+void create_spool(const spool* const q, const unsigned* const pages, const size_t num_pages)
+{
+	char tmp[PATH_MAX], name[PATH_MAX];
+
+	make_path(tmp, "%s.XXXXXX", q->dir);
+
+	if(!mkdtemp(tmp))
+		die(errno, "cannot create directory \"%s\"", tmp);
+
+	make_path(name, "%s/claims", tmp);
+	make_dir(name);
+	make_path(name, "%s/failed", tmp);
+	make_dir(name);
+	make_path(name, "%s/todo", tmp);
+	make_dir(name);
+
+	for(size_t i = 0; i < num_pages; ++i)
+	{
+		make_path(name, "%s/todo/%u", tmp, pages[i]);
+
+		const int fd = open(name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+
+		if(fd < 0)
+			die(errno, "cannot create file \"%s\"", name);
+
+		just(close(fd));
+	}
+
+	just(chmod(tmp, 0755));
+
+	if(rename(tmp, q->dir) == 0)
+		return;
+
+	if(errno != EEXIST && errno != ENOTEMPTY)
+		die(errno, "cannot rename directory \"%s\"", tmp);
+
+	make_path(name, "%s/todo", tmp);
+	remove_dir(name);
+	make_path(name, "%s/claims", tmp);
+	rmdir(name);
+	make_path(name, "%s/failed", tmp);
+	rmdir(name);
+	rmdir(tmp);
+}
+
+// refresh the heartbeat file, recreating the claim directory if it has been taken over
+// by another worker
+static
+void touch_heartbeat(const spool* const q)
+{
+	make_dir(q->claims);
+
+	const int fd = open(q->heartbeat, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+
+	if(fd < 0)
+		die(errno, "cannot create file \"%s\"", q->heartbeat);
+
+	if(futimens(fd, NULL) < 0)
+		die(errno, "cannot update file \"%s\"", q->heartbeat);
+
+	just(close(fd));
+}
+
+// heartbeat process: refresh the heartbeat file four times per lease, until the parent is gone
+static __attribute__((noreturn))
+void beat(const spool* const q, const pid_t parent)
+{
+	const unsigned interval = max(q->lease / 4, 1u);
+
+	for(;;)
+	{
+		sleep(interval);
+
+		if(getppid() != parent)
+			_exit(0);
+
+		touch_heartbeat(q);
+	}
+}
+
+static
+int cmp_pages(const void* const a, const void* const b)
+{
+	const unsigned x = *(const unsigned*)a, y = *(const unsigned*)b;
+
+	return (x > y) - (x < y);
+}
+
+// check if the directory holds any of our pages
+static
+bool has_pages(const spool* const q, const char* const name)
+{
+	DIR* const dir = opendir(name);
+
+	if(!dir)
+		return false;	// taken over meanwhile
+
+	bool found = false;
+
+	for(const struct dirent* ent = readdir(dir); ent && !found; ent = readdir(dir))
+	{
+		char* end;
+		const unsigned long page = strtoul(ent->d_name, &end, 10);
+
+		found = (ent->d_name[0] != '.' && *end == 0 && page <= UINT_MAX
+				 && bsearch(&(unsigned){ page }, q->pages, q->num_pages, sizeof(unsigned), cmp_pages));
+	}
+
+	closedir(dir);
+
+	return found;
+}
+
+// check if the directory holds any page
+static
+bool has_any_page(const char* const name)
+{
+	DIR* const dir = opendir(name);
+
+	if(!dir)
+		return false;
+
+	bool found = false;
+
+	for(const struct dirent* ent = readdir(dir); ent && !found; ent = readdir(dir))
+		found = (ent->d_name[0] != '.');
+
+	closedir(dir);
+
+	return found;
+}
+
+// call fn for each claim directory in the spool, until it returns true; returns true
+// if it does
+static
+bool any_claims(const char* const spool_dir, bool (*fn)(const void* ctx, const char* name), const void* const ctx)
+{
+	char name[PATH_MAX], worker[PATH_MAX];
+
+	make_path(name, "%s/claims", spool_dir);
+
+	DIR* const dir = opendir(name);
+
+	if(!dir)
+		return false;
+
+	bool found = false;
+
+	for(const struct dirent* ent = readdir(dir); ent && !found; ent = readdir(dir))
+	{
+		if(ent->d_name[0] == '.')
+			continue;
+
+		make_path(worker, "%s/%s", name, ent->d_name);
+		found = fn(ctx, worker);
+	}
+
+	closedir(dir);
+
+	return found;
+}
+
+static
+bool claims_any_page(const void* const UNUSED(ctx), const char* const name)
+{
+	return has_any_page(name);
+}
+
+static
+bool claims_our_pages(const void* const ctx, const char* const name)
+{
+	return has_pages(ctx, name);
+}
+
+// check if all the pages of the spool are done: none left in the queue, and none claimed
+static
+bool is_spent(const char* const spool_dir)
+{
+	char name[PATH_MAX];
+
+	make_path(name, "%s/todo", spool_dir);
+
+	return !has_any_page(name) && !any_claims(spool_dir, claims_any_page, NULL);
+}
+
+// check if any of our pages are in the spool: queued, claimed, or failed
+static
+bool is_queued(const spool* const q)
+{
+	char name[PATH_MAX];
+
+	make_path(name, "%s/todo", q->dir);
+
+	if(has_pages(q, name))
+		return true;
+
+	make_path(name, "%s/failed", q->dir);
+
+	return has_pages(q, name) || any_claims(q->dir, claims_our_pages, q);
+}
+
+// move the pages and the claim directories of the spool into the other one
+static
+void merge_spool(const char* const from, const char* const to)
+{
+	static const char* const subdirs[] = { "todo", "claims", "failed" };
+	char src[PATH_MAX], dest[PATH_MAX];
+
+	for(size_t i = 0; i < sizeof(subdirs) / sizeof(subdirs[0]); ++i)
+	{
+		make_path(src, "%s/%s", from, subdirs[i]);
+
+		DIR* const dir = opendir(src);
+
+		if(!dir)
+			continue;
+
+		for(const struct dirent* ent = readdir(dir); ent; ent = readdir(dir))
+		{
+			if(ent->d_name[0] == '.')
+				continue;
+
+			make_path(dest, "%s/%s/%s", to, subdirs[i], ent->d_name);
+			renameat(dirfd(dir), ent->d_name, AT_FDCWD, dest);
+		}
+
+		closedir(dir);
+	}
+}
+
+// move the spent spool out of the way, to be replaced through create_spool(); should
+// another worker have just replaced it, the new spool is put back
+static
+void retire_spool(const spool* const q)
+{
+	char old[PATH_MAX], name[PATH_MAX];
+
+	make_path(old, "%s.old.XXXXXX", q->dir);
+
+	if(!mkdtemp(old))
+		die(errno, "cannot create directory \"%s\"", old);
+
+	if(rename(q->dir, old) != 0)
+	{
+		const int err = errno;
+
+		rmdir(old);
+
+		if(err == ENOENT)
+			return;	// retired by another worker
+
+		die(err, "cannot rename directory \"%s\"", q->dir);
+	}
+
+	if(!is_spent(old) && rename(old, q->dir) != 0)
+	{
+		// yet another worker has created a spool meanwhile
+		if(errno != EEXIST && errno != ENOTEMPTY)
+			die(errno, "cannot rename directory \"%s\"", old);
+
+		merge_spool(old, q->dir);
+	}
+
+	// remove what is left of the old spool
+	if(access(old, F_OK) == 0)
+	{
+		make_path(name, "%s/todo", old);
+		remove_dir(name);
+		make_path(name, "%s/failed", old);
+		remove_dir(name);
+		make_path(name, "%s/claims", old);
+		remove_claims(name);
+		rmdir(old);
+	}
+}
+
+bool spool_open(spool* const q, const char* const dir, const unsigned* const pages, const size_t num_pages,
+				const unsigned lease)
+{
+	*q = (spool){ .lease = lease };
+
+	just(asprintf(&q->dir, "%s/" SPOOL_DIR, dir));
+
+	// our pages, for polling
+	q->pages = mem_alloc(max(num_pages, (size_t)1) * sizeof(unsigned));
+	q->num_pages = num_pages;
+
+	memcpy(q->pages, pages, num_pages * sizeof(unsigned));
+	qsort(q->pages, num_pages, sizeof(unsigned), cmp_pages);
+
+	// a spool emptied by a previous run is replaced by a new one
+	struct stat info;
+
+	if(stat(q->dir, &info) == 0 && is_spent(q->dir))
+		retire_spool(q);
+
+	if(stat(q->dir, &info) < 0)
+	{
+		if(errno != ENOENT)
+			die(errno, "cannot stat directory \"%s\"", q->dir);
+
+		create_spool(q, pages, num_pages);
+	}
+
+	const bool queued = is_queued(q);
+
+	// claim directory, named after the host and the process
+	char host[HOST_NAME_MAX + 1];
+
+	if(gethostname(host, sizeof(host)) < 0)
+		die(errno, "cannot get host name");
+
+	host[HOST_NAME_MAX] = 0;
+
+	just(asprintf(&q->claims, "%s/claims/%s-%d", q->dir, host, (int)getpid()));
+	just(asprintf(&q->heartbeat, "%s/" HEARTBEAT_FILE, q->claims));
+
+	touch_heartbeat(q);
+
+	// heartbeat process
+	const pid_t parent = getpid();
+
+	just(fflush(NULL));
+
+	if((q->beater = just(fork())) == 0)
+		beat(q, parent);
+
+	return queued;
+}
+
+void spool_close(spool* const q)
+{
+	if(q->beater > 0)
+	{
+		kill(q->beater, SIGTERM);
+		waitpid(q->beater, NULL, 0);
+	}
+
+	// the claim directory still holding pages is left to be taken over by other workers
+	if(q->heartbeat)
+	{
+		unlink(q->heartbeat);
+		rmdir(q->claims);
+	}
+
+	free(q->dir);
+	free(q->claims);
+	free(q->heartbeat);
+	mem_free(q->pages);
+
+	*q = (spool){ .dir = NULL };
+}
+
+bool spool_claim(spool* const q, const unsigned page)
+{
+	char from[PATH_MAX], to[PATH_MAX];
+
+	make_path(from, "%s/todo/%u", q->dir, page);
+	make_path(to, "%s/%u", q->claims, page);
+
+	if(rename(from, to) == 0)
+		return true;
+
+	if(errno != ENOENT)
+		die(errno, "cannot claim page %u in \"%s\"", page, q->dir);
+
+	// the page is not in the queue, unless our claim directory has been taken over
+	if(access(q->claims, F_OK) == 0)
+		return false;
+
+	touch_heartbeat(q);
+
+	return rename(from, to) == 0;
+}
+
+void spool_release(spool* const q, const unsigned page, const bool failed)
+{
+	char name[PATH_MAX], todo[PATH_MAX], dest[PATH_MAX];
+
+	make_path(name, "%s/%u", q->claims, page);
+	make_path(todo, "%s/todo/%u", q->dir, page);
+	make_path(dest, "%s/failed/%u", q->dir, page);
+
+	if((failed ? rename(name, dest) : unlink(name)) == 0)
+		return;
+
+	if(errno != ENOENT)
+		die(errno, "cannot release page %u in \"%s\"", page, q->dir);
+
+	// the page has been given back to the queue by a worker that has taken us for gone;
+	// take it out again, unless another worker has already claimed it
+	if(failed)
+		rename(todo, dest);
+	else
+		unlink(todo);
+}
+
+// give the pages of the worker gone back to the queue; returns the number of pages
+static
+size_t reclaim(const spool* const q, const char* const name)
+{
+	DIR* const dir = opendir(name);
+
+	if(!dir)
+		return 0;	// taken over by another worker
+
+	size_t n = 0;
+	char todo[PATH_MAX];
+
+	for(const struct dirent* ent = readdir(dir); ent; ent = readdir(dir))
+	{
+		if(ent->d_name[0] == '.')
+			continue;
+
+		make_path(todo, "%s/todo/%s", q->dir, ent->d_name);
+
+		if(renameat(dirfd(dir), ent->d_name, AT_FDCWD, todo) == 0)
+			++n;
+	}
+
+	closedir(dir);
+
+	char heartbeat[PATH_MAX];
+
+	make_path(heartbeat, "%s/" HEARTBEAT_FILE, name);
+	unlink(heartbeat);
+	rmdir(name);
+
+	return n;
+}
+
+spool_state spool_poll(spool* const q, size_t* const reclaimed)
+{
+	// heartbeats are compared with ours, so that only the clock of the file server matters
+	struct stat own;
+
+	touch_heartbeat(q);
+
+	if(stat(q->heartbeat, &own) < 0)
+		die(errno, "cannot stat file \"%s\"", q->heartbeat);
+
+	// the other workers
+	char name[PATH_MAX], worker[PATH_MAX], heartbeat[PATH_MAX];
+
+	make_path(name, "%s/claims", q->dir);
+
+	DIR* const dir = opendir(name);
+
+	if(!dir)
+		die(errno, "cannot open directory \"%s\"", name);
+
+	const char* const self = strrchr(q->claims, '/') + 1;
+	bool busy = false;
+
+	for(const struct dirent* ent = readdir(dir); ent; ent = readdir(dir))
+	{
+		if(ent->d_name[0] == '.' || strcmp(ent->d_name, self) == 0)
+			continue;
+
+		make_path(worker, "%s/%s", name, ent->d_name);
+		make_path(heartbeat, "%s/" HEARTBEAT_FILE, worker);
+
+		// a worker that has just created its directory may have no heartbeat file yet
+		struct stat info;
+
+		if(stat(heartbeat, &info) < 0 && stat(worker, &info) < 0)
+			continue;	// gone meanwhile
+
+		if(own.st_mtime - info.st_mtime > (time_t)q->lease)
+			*reclaimed += reclaim(q, worker);
+		else
+			busy = busy || has_pages(q, worker);
+	}
+
+	closedir(dir);
+
+	// our pages still in the queue
+	make_path(name, "%s/todo", q->dir);
+
+	return has_pages(q, name) ? SPOOL_PENDING : busy ? SPOOL_BUSY : SPOOL_EMPTY;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "utils.h"
+
+#include <sys/types.h>
+
+// queue of the pages to recognise, shared by any number of ocr processes through the
+// project directory; a page is claimed by renaming its token from the "todo" directory
+// into the claim directory of the worker, which keeps its heartbeat file fresh while it
+// runs. The pages of a worker whose heartbeat is older than the lease are given back
+// to the queue.
+typedef struct
+{
+	char* dir;			// spool directory
+	char* claims;		// claim directory of this worker
+	char* heartbeat;	// heartbeat file of this worker
+	unsigned* pages;	// pages of this worker, sorted
+	size_t num_pages;
+	unsigned lease;		// in seconds
+	pid_t beater;		// process keeping the heartbeat fresh
+} spool;
+
+// state of the queue
+typedef enum
+{
+	SPOOL_EMPTY,	// no pages left, neither to claim, nor claimed by other workers
+	SPOOL_PENDING,	// pages left to claim
+	SPOOL_BUSY		// pages claimed by other workers still alive
+} spool_state;
+
+// open the spool in the given directory, creating it with the given pages unless another
+// worker has already done so, and start the heartbeat; a spool with all its pages done
+// is replaced. Returns false if none of the given pages are in the spool.
+bool spool_open(spool* const q, const char* const dir, const unsigned* const pages, const size_t num_pages,
+				const unsigned lease);
+
+// close the spool; the spool directory is left for the other workers
+void spool_close(spool* const q);
+
+// claim the given page; returns false if the page has been claimed by another worker,
+// or is done
+bool spool_claim(spool* const q, const unsigned page);
+
+// release the claimed page once it is done; failed pages are kept in the "failed" directory
+void spool_release(spool* const q, const unsigned page, const bool failed);
+
+// give the pages of the workers gone back to the queue, and return the state of the queue
+// with respect to the pages of this worker; the number of pages given back is added
+// to *reclaimed
+spool_state spool_poll(spool* const q, size_t* const reclaimed);
@@ -1,5 +1,6 @@
 #include "utils.h"
 #include "tesseract.h"
+#include "list_pages.h"
 
 #include <string.h>
 #include <errno.h>
@@ -8,6 +9,13 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <sys/random.h>
 #include <assert.h>
 
 #define _die(code, msg, ...) 	(error(0, (code), "" msg, ##__VA_ARGS__), _exit(1))
@@ -67,14 +75,31 @@ int _just_int_impl(const int ret, const char* const file, const int line)
 
 typedef enum { RD_NONE, RD_STDOUT, RD_STDERR } redirect;
 
+// resource limits for recognition processes
+static tess_limits limits;
+
+void tess_set_limits(const tess_limits* const lim)
+{
+	limits = *lim;
+}
+
 static __attribute__((noreturn))
 void read_out_child(const redirect flags,
+					const tess_limits* const lim,
 					const int pfd[2],
 					const char* const prog,
 					const char* const args[])
 {
 	_just(close(pfd[0]));				// unused read end
 
+	// CPU time limit: SIGXCPU at the soft limit, SIGKILL one second later
+	if(lim && lim->cpu_time > 0)
+	{
+		const struct rlimit rl = { lim->cpu_time, lim->cpu_time + 1 };
+
+		_just(setrlimit(RLIMIT_CPU, &rl));
+	}
+
 	if(flags & RD_STDOUT)
 		_just(dup2(pfd[1], STDOUT_FILENO));	// dup write end to stdout
 
@@ -89,13 +114,10 @@ void read_out_child(const redirect flags,
 }
 
 static
-str_list* read_str_list(const int fd)
+str_list* read_str_list(FILE* const stream)
 {
 	str_list* list = NULL;
 
-	// open input stream
-	FILE* const stream = just(fdopen(fd, "r"));
-
 	// read command output
 	char* line = NULL;
 	size_t cap = 0;
@@ -123,10 +145,116 @@ typedef struct
 {
 	str_list* list;
 	int status;
+	tess_status limit;	// limit exceeded by the process, if any
 } read_out_result;
 
+// resident set size of the given process, in bytes
+static
+unsigned long process_rss(const pid_t pid)
+{
+	char name[40];
+
+	sprintf(name, "/proc/%d/statm", (int)pid);
+
+	FILE* const stream = fopen(name, "re");
+
+	if(!stream)
+		return 0;	// the process has already terminated
+
+	unsigned long size = 0, resident = 0;
+
+	if(fscanf(stream, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+
+	fclose(stream);
+
+	return resident * (unsigned long)sysconf(_SC_PAGESIZE);
+}
+
+static
+double elapsed_since(const struct timespec* const start)
+{
+	struct timespec now;
+
+	just(clock_gettime(CLOCK_MONOTONIC, &now));
+
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+// interval between the checks of the wall-clock time and memory usage, in milliseconds
+#define LIMIT_CHECK_INTERVAL 100
+
+// read the output of the process while watching its wall-clock time and memory usage;
+// the process is killed once it exceeds either limit
+static
+str_list* read_str_list_limited(const int fd, const pid_t pid,
+								const tess_limits* const lim, tess_status* const plimit)
+{
+	struct timespec start;
+
+	just(clock_gettime(CLOCK_MONOTONIC, &start));
+
+	char* buff = NULL;
+	size_t size = 0;
+	FILE* const mem = just(open_memstream(&buff, &size));
+
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	for(;;)
+	{
+		const int ret = poll(&pfd, 1, LIMIT_CHECK_INTERVAL);
+
+		if(ret < 0 && errno != EINTR)
+			die(errno, "internal error (poll)");
+
+		if(ret > 0)
+		{
+			char chunk[4096];
+			const ssize_t n = read(fd, chunk, sizeof(chunk));
+
+			if(n < 0 && errno != EINTR)
+				die(errno, "internal error (read)");
+
+			if(n == 0)
+				break;	// end of output
+
+			if(n > 0 && fwrite(chunk, 1, n, mem) != (size_t)n)
+				die(errno, "internal error (fwrite)");
+		}
+
+		if(lim->timeout > 0 && elapsed_since(&start) > lim->timeout)
+			*plimit = TESS_TIMEOUT;
+		else if(lim->max_rss > 0 && process_rss(pid) > lim->max_rss)
+			*plimit = TESS_MEMORY_LIMIT;
+		else
+			continue;
+
+		kill(pid, SIGKILL);
+		break;
+	}
+
+	just(close(fd));
+	just(fclose(mem));
+
+	// parse the output
+	str_list* const list = (size > 0) ? read_str_list(just(fmemopen(buff, size, "r"))) : NULL;
+
+	free(buff);
+
+	return list;
+}
+
+// CPU time used by a process, in seconds
+static
+double cpu_seconds(const struct rusage* const usage)
+{
+	return (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec)
+		 + (usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) * 1e-6;
+}
+
 static
 read_out_result _read_out_impl(const redirect flags,
+							   const tess_limits* const lim,
 							   const char* const prog,
 							   const char* const args[])
 {
@@ -143,23 +271,43 @@ read_out_result _read_out_impl(const redirect flags,
 	const int pid = just(fork());
 
 	if(pid == 0)	// child process
-		read_out_child(flags, pfd, prog, args);
+		read_out_child(flags, lim, pfd, prog, args);
 
 	just(close(pfd[1]));	// unused write end
 
-	// read file list
-	read_out_result res = (read_out_result){ .list = read_str_list(pfd[0]) };
+	// read the output
+	read_out_result res = { .limit = TESS_OK };
 
-	// wait for the child to terminate
-	just(waitpid(pid, &res.status, 0));
+	if(lim && (lim->timeout > 0 || lim->max_rss > 0))
+		res.list = read_str_list_limited(pfd[0], pid, lim, &res.limit);
+	else
+		res.list = read_str_list(just(fdopen(pfd[0], "r")));
+
+	// wait for the child to terminate, with its resource usage for the CPU time check
+	struct rusage usage;
+
+	just(wait4(pid, &res.status, 0, &usage));
 
 	// check the status
 	if(WIFEXITED(res.status))
+	{
 		res.status = WEXITSTATUS(res.status);
+		res.limit = TESS_OK;	// terminated on its own before it could be killed
+	}
 	else if(WIFSIGNALED(res.status))
 	{
 		const int sig = WTERMSIG(res.status);
 
+		if(res.limit != TESS_OK)
+			return res;
+
+		// SIGKILL is sent at the hard limit, but may as well come from the OOM killer or the user
+		if(lim && lim->cpu_time > 0 && (sig == SIGXCPU || (sig == SIGKILL && cpu_seconds(&usage) >= lim->cpu_time)))
+		{
+			res.limit = TESS_CPU_LIMIT;
+			return res;
+		}
+
 		die(0, "program \"%s\" killed by signal %d: %s", prog, sig, strsignal(sig));
 	}
 
@@ -170,7 +318,7 @@ read_out_result _read_out_impl(const redirect flags,
 #define read_out(flags, prog, ...)	\
 ({	\
 	const char* const __args[] = { program_invocation_name, ##__VA_ARGS__, NULL };	\
-	_read_out_impl((flags), (prog), __args);	\
+	_read_out_impl((flags), NULL, (prog), __args);	\
 })
 
 #define TESS_ERR_PREFIX "Error"
@@ -207,11 +355,19 @@ str_list* tess_just(const read_out_result res)
 }
 
 static
-void tess_run(const char* args[])
+tess_status tess_run(const char* args[])
 {
-	str_list* const list = tess_just(_read_out_impl(RD_STDOUT | RD_STDERR, "tesseract", args));
+	const read_out_result res = _read_out_impl(RD_STDOUT | RD_STDERR, &limits, "tesseract", args);
+
+	if(res.limit != TESS_OK)
+	{
+		str_list_free(res.list);
+		return res.limit;
+	}
+
+	str_list_free(tess_just(res));
 
-	str_list_free(list);
+	return TESS_OK;
 }
 
 // check tesseract presence and version
@@ -228,9 +384,14 @@ void tess_check(void)
 }
 
 // read list of installed languages
-str_list* tess_langs(void)
+str_list* tess_langs(const char* const tessdata_dir)
 {
-	str_list* const list = tess_just(read_out(RD_STDOUT | RD_STDERR, "tesseract", "--list-langs"));
+	str_list* const list = tessdata_dir
+		? tess_just(read_out(RD_STDOUT | RD_STDERR, "tesseract", "--tessdata-dir", tessdata_dir, "--list-langs"))
+		: tess_just(read_out(RD_STDOUT | RD_STDERR, "tesseract", "--list-langs"));
+
+	if(!list)
+		die(0, "no languages installed for \"tesseract\"");
 
 	// discard the first line by replacing it with the last one
 	if(list->len > 1)
@@ -258,7 +419,6 @@ void check_file(const str file)
 }
 
 #define EXT 	".pgm"
-#define EXT_LEN	(sizeof(EXT) - 1)
 
 static
 void tess_templ(str* const dest, const str name)
@@ -267,37 +427,279 @@ void tess_templ(str* const dest, const str name)
 	if(!str_has_suffix(name, str_lit(EXT)))
 		die(0, "unexpected file name \"%.*s\"", (int)str_len(name), str_ptr(name));
 
-	str_cpy(dest, str_ref_chars(str_ptr(name), str_len(name) - EXT_LEN));
+	// the output for the images in the RAM store goes to the project directory
+	char* const txt = page_file_ext(name, "");
+
+	str_cpy(dest, str_ref_chars(txt, strlen(txt) - 1));	// without the dot
+	free(txt);
 }
 
-// extract text from the given file
-void tess_extract_text(const str file, const char** opts, const unsigned num_opts)
+static
+tess_status tess_extract(const str file, const str templ, const char* const separator,
+				  const char** opts, const unsigned num_opts,
+				  const char* const* configs)
 {
-	// check file
-	check_file(file);
+	unsigned num_configs = 0;
 
-	// template name
-	str templ = str_null;
-
-	tess_templ(&templ, file);
+	while(configs && configs[num_configs])
+		++num_configs;
 
 	// args list
-	const char** const args = mem_alloc((6 + num_opts) * sizeof(char*));
+	const char** const args = mem_alloc((6 + num_opts + num_configs) * sizeof(char*));
 	const char** p = args;
 
 	*p++ = program_invocation_name;
 	*p++ = str_ptr(file);
 	*p++ = str_ptr(templ);
 	*p++ = "-c";
-	*p++ = "page_separator=";
+	*p++ = separator;
 
 	for(unsigned i = 0; i < num_opts; ++i)
 		*p++ = opts[i];
 
+	for(unsigned i = 0; i < num_configs; ++i)
+		*p++ = configs[i];
+
 	*p = NULL;
 
-	tess_run(args);
+	const tess_status status = tess_run(args);
 
-	str_free(templ);
 	mem_free(args);
+
+	return status;
+}
+
+// extract text from the given file
+tess_status tess_extract_text(const str file, const char** opts, const unsigned num_opts)
+{
+	// check file
+	check_file(file);
+
+	// template name
+	str templ = str_null;
+
+	tess_templ(&templ, file);
+
+	const tess_status status = tess_extract(file, templ, "page_separator=", opts, num_opts, NULL);
+
+	str_free(templ);
+
+	return status;
+}
+
+// write the text of one page of a multi-page run
+static
+void write_page_text(const str file, const char* const text, const size_t len)
+{
+	str templ = str_null;
+
+	tess_templ(&templ, file);
+
+	char* name = NULL;
+
+	just(asprintf(&name, "%s.txt", str_ptr(templ)));
+
+	FILE* const out = fopen(name, "we");
+
+	if(!out)
+		die(errno, "cannot create file \"%s\"", name);
+
+	if(fwrite(text, 1, len, out) != len || fclose(out) != 0)
+		die(errno, "error writing file \"%s\"", name);
+
+	free(name);
+	str_free(templ);
+}
+
+// extract text from the given files in one tesseract run, so that the models are loaded
+// only once; the output is split into the text files of the pages on a separator that
+// cannot appear in the recognised text
+tess_status tess_extract_text_list(const str* const files, const size_t num_files, const char* const tmp,
+								   const char** opts, const unsigned num_opts)
+{
+	assert(num_files > 0);
+
+	// list of the files
+	char *list = NULL, *base = NULL, *out = NULL;
+
+	just(asprintf(&list, "%s-list.txt", tmp));
+	just(asprintf(&base, "%s-out", tmp));
+	just(asprintf(&out, "%s.txt", base));
+
+	FILE* const stream = fopen(list, "we");
+
+	if(!stream)
+		die(errno, "cannot create file \"%s\"", list);
+
+	for(size_t i = 0; i < num_files; ++i)
+	{
+		check_file(files[i]);
+
+		if(fprintf(stream, "%s\n", str_ptr(files[i])) < 0)
+			die(errno, "error writing file \"%s\"", list);
+	}
+
+	if(fclose(stream) != 0)
+		die(errno, "error writing file \"%s\"", list);
+
+	// separator
+	uint64_t key;
+
+	if(getrandom(&key, sizeof(key), 0) != sizeof(key))
+		die(errno, "cannot generate page separator");
+
+	char sep[64];
+	const int sep_len = snprintf(sep, sizeof(sep), "<ocr-page-break-%016" PRIx64 ">", key);
+	char* sep_opt = NULL;
+
+	just(asprintf(&sep_opt, "page_separator=%s", sep));
+
+	// run
+	const tess_status status = tess_extract(str_ref_from_ptr(list), str_ref_from_ptr(base), sep_opt,
+											opts, num_opts, NULL);
+
+	if(unlink(list) < 0)
+		die(errno, "cannot delete file \"%s\"", list);
+
+	free(sep_opt);
+	free(base);
+	free(list);
+
+	if(status != TESS_OK)
+	{
+		unlink(out);
+		free(out);
+		return status;
+	}
+
+	// read the output
+	FILE* const input = fopen(out, "re");
+
+	if(!input)
+		die(errno, "cannot open file \"%s\"", out);
+
+	char* text = NULL;
+	size_t cap = 0;
+	const ssize_t n = getdelim(&text, &cap, 0, input);
+
+	if(ferror(input))
+		die(errno, "error reading file \"%s\"", out);
+
+	just(fclose(input));
+
+	if(unlink(out) < 0)
+		die(errno, "cannot delete file \"%s\"", out);
+
+	// split it; depending on the version, tesseract writes the separator either between
+	// the pages, or after each of them
+	const char* s = text;
+	const char* const end = text + max(n, (ssize_t)0);
+	size_t i = 0;
+
+	for(; i < num_files; ++i)
+	{
+		const char* p = memmem(s, end - s, sep, sep_len);
+
+		if(!p)
+		{
+			if(i + 1 < num_files)
+				break;
+
+			p = end;
+		}
+
+		write_page_text(files[i], s, p - s);
+		s = min(p + sep_len, end);
+	}
+
+	if(i < num_files || s != end)
+		die(0, "unexpected number of pages in the output of \"tesseract\" (expected %zu)", num_files);
+
+	mem_free(text);
+	free(out);
+
+	return TESS_OK;
+}
+
+// mean confidence of the words from the given .tsv file
+static
+double tsv_mean_conf(const char* const name)
+{
+	FILE* const stream = fopen(name, "re");
+
+	if(!stream)
+		die(errno, "cannot open file \"%s\"", name);
+
+	char* line = NULL;
+	size_t cap = 0;
+	double sum = 0;
+	unsigned n = 0;
+
+	// fields: level page_num block_num par_num line_num word_num left top width height conf text
+	while(getline(&line, &cap, stream) >= 0)
+	{
+		if(line[0] != '5' || line[1] != '\t')
+			continue;	// not a word
+
+		const char* s = line;
+
+		for(unsigned i = 0; i < 10 && s; ++i)
+			if((s = strchr(s, '\t')))
+				++s;
+
+		if(!s)
+			continue;
+
+		char* end;
+		const double conf = strtod(s, &end);
+
+		if(end != s && *end == '\t' && conf >= 0)
+		{
+			sum += conf;
+			++n;
+		}
+	}
+
+	mem_free(line);
+	just(fclose(stream));
+
+	return (n > 0) ? (sum / n) : -1;
+}
+
+// extract text from the given file, and get mean word confidence
+tess_status tess_extract_text_conf(const str file, const char** opts, const unsigned num_opts,
+								   double* const conf)
+{
+	static const char* const configs[] = { "txt", "tsv", NULL };
+
+	// check file
+	check_file(file);
+
+	// template name
+	str templ = str_null;
+
+	tess_templ(&templ, file);
+
+	const tess_status status = tess_extract(file, templ, "page_separator=", opts, num_opts, configs);
+
+	if(status != TESS_OK)
+	{
+		str_free(templ);
+		return status;
+	}
+
+	// read confidence
+	char* tsv = NULL;
+
+	just(asprintf(&tsv, "%s.tsv", str_ptr(templ)));
+
+	*conf = tsv_mean_conf(tsv);
+
+	if(unlink(tsv) < 0)
+		die(errno, "cannot delete file \"%s\"", tsv);
+
+	free(tsv);
+	str_free(templ);
+
+	return TESS_OK;
 }
@@ -5,8 +5,33 @@
 // check tesseract presence and version
 void tess_check(void);
 
-// read list of installed languages
-str_list* tess_langs(void);
+// read list of installed languages, from the given tessdata directory, or the default one
+// if NULL
+str_list* tess_langs(const char* const tessdata_dir);
+
+// resource limits for each tesseract run (0 means no limit)
+typedef struct
+{
+	unsigned timeout;		// wall-clock time, in seconds
+	unsigned cpu_time;		// CPU time, in seconds
+	unsigned long max_rss;	// resident set size, in bytes
+} tess_limits;
+
+// outcome of a tesseract run; a process exceeding any of the limits is killed
+typedef enum { TESS_OK, TESS_TIMEOUT, TESS_CPU_LIMIT, TESS_MEMORY_LIMIT } tess_status;
+
+// set resource limits for the subsequent tesseract runs
+void tess_set_limits(const tess_limits* const lim);
 
 // extract text from the given file
-void tess_extract_text(const str file, const char** opts, const unsigned num_opts);
\ No newline at end of file
+tess_status tess_extract_text(const str file, const char** opts, const unsigned num_opts);
+
+// extract text from the given file, and get mean word confidence (0 to 100),
+// or -1 if no words have been recognised
+tess_status tess_extract_text_conf(const str file, const char** opts, const unsigned num_opts,
+								   double* const conf);
+
+// extract text from the given files in one tesseract run, writing the text of each file
+// as tess_extract_text() does; the temporary files of the run are named with the given prefix
+tess_status tess_extract_text_list(const str* const files, const size_t num_files, const char* const tmp,
+								   const char** opts, const unsigned num_opts);
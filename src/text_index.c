@@ -0,0 +1,578 @@
+#include "text_index.h"
+#include "list_pages.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// index file name, relative to the project directory
+#define INDEX_FILE ".ocr-index"
+
+// index file layout, in little-endian byte order: header, page records, trigram records,
+// postings
+#define INDEX_SIGNATURE "OCRTRI1\n"
+
+typedef struct
+{
+	char signature[8];
+	uint32_t num_pages, num_grams;
+	uint64_t num_postings;
+} index_header;
+
+struct index_page
+{
+	uint32_t page, pad;
+	int64_t sec, nsec;		// modification time
+	uint64_t size;
+};
+
+struct index_gram
+{
+	uint32_t gram, count;
+	uint64_t start;			// index of the first posting
+};
+
+// trigram of three bytes, folded to lower case
+static inline
+uint32_t trigram(const unsigned char* const p)
+{
+	return ((uint32_t)fold_case(p[0]) << 16) | ((uint32_t)fold_case(p[1]) << 8) | fold_case(p[2]);
+}
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+// swap the bytes of all the index fields, from the file order to the host order or back
+static
+void swap_index(void* const base, const size_t size, const bool to_host)
+{
+	index_header* const h = base;
+
+	if(size < sizeof(index_header))
+		return;
+
+	if(to_host)
+	{
+		h->num_pages = __builtin_bswap32(h->num_pages);
+		h->num_grams = __builtin_bswap32(h->num_grams);
+		h->num_postings = __builtin_bswap64(h->num_postings);
+	}
+
+	const uint64_t num_pages = h->num_pages, num_grams = h->num_grams, num_postings = h->num_postings;
+
+	if(!to_host)
+	{
+		h->num_pages = __builtin_bswap32(h->num_pages);
+		h->num_grams = __builtin_bswap32(h->num_grams);
+		h->num_postings = __builtin_bswap64(h->num_postings);
+	}
+
+	// a broken index is rejected by attach()
+	if(sizeof(index_header) + num_pages * sizeof(struct index_page) + num_grams * sizeof(struct index_gram)
+	   + num_postings * sizeof(uint32_t) != size)
+		return;
+
+	struct index_page* const pages = (struct index_page*)(h + 1);
+
+	for(uint64_t i = 0; i < num_pages; ++i)
+	{
+		pages[i].page = __builtin_bswap32(pages[i].page);
+		pages[i].pad = __builtin_bswap32(pages[i].pad);
+		pages[i].sec = __builtin_bswap64(pages[i].sec);
+		pages[i].nsec = __builtin_bswap64(pages[i].nsec);
+		pages[i].size = __builtin_bswap64(pages[i].size);
+	}
+
+	struct index_gram* const grams = (struct index_gram*)(pages + num_pages);
+
+	for(uint64_t i = 0; i < num_grams; ++i)
+	{
+		grams[i].gram = __builtin_bswap32(grams[i].gram);
+		grams[i].count = __builtin_bswap32(grams[i].count);
+		grams[i].start = __builtin_bswap64(grams[i].start);
+	}
+
+	uint32_t* const postings = (uint32_t*)(grams + num_grams);
+
+	for(uint64_t i = 0; i < num_postings; ++i)
+		postings[i] = __builtin_bswap32(postings[i]);
+}
+#endif
+
+// set the index pointers from the buffer, checking the layout
+static
+bool attach(text_index* const idx)
+{
+	const index_header* const h = idx->base;
+
+	if(idx->size < sizeof(index_header) || memcmp(h->signature, INDEX_SIGNATURE, sizeof(h->signature)) != 0)
+		return false;
+
+	const uint64_t expected = sizeof(index_header)
+							+ (uint64_t)h->num_pages * sizeof(struct index_page)
+							+ (uint64_t)h->num_grams * sizeof(struct index_gram)
+							+ h->num_postings * sizeof(uint32_t);
+
+	if(expected != idx->size)
+		return false;
+
+	idx->num_pages = h->num_pages;
+	idx->num_grams = h->num_grams;
+	idx->num_postings = h->num_postings;
+	idx->pages = (const struct index_page*)(h + 1);
+	idx->grams = (const struct index_gram*)(idx->pages + h->num_pages);
+	idx->postings = (const uint32_t*)(idx->grams + h->num_grams);
+
+	// make sure the postings are within bounds
+	for(uint32_t i = 0; i < idx->num_grams; ++i)
+		if(idx->grams[i].start + idx->grams[i].count > idx->num_postings)
+			return false;
+
+	return true;
+}
+
+// map the existing index, if any
+static
+void load(text_index* const idx, const char* const name)
+{
+	*idx = (text_index){0};
+
+	const int fd = open(name, O_RDONLY | O_CLOEXEC);
+
+	if(fd < 0)
+	{
+		if(errno != ENOENT)
+			error(0, errno, "cannot open file \"%s\", rebuilding the index", name);
+
+		return;
+	}
+
+	struct stat info;
+
+	just(fstat(fd, &info));
+
+	if(info.st_size > 0)
+	{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		// the private mapping is swapped in place
+		void* const p = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+		if(p == MAP_FAILED)
+			die(errno, "cannot map file \"%s\"", name);
+
+		swap_index(p, info.st_size, true);
+#else
+		void* const p = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if(p == MAP_FAILED)
+			die(errno, "cannot map file \"%s\"", name);
+#endif
+
+		*idx = (text_index){ .base = p, .size = info.st_size, .mapped = true };
+
+		if(!attach(idx))
+		{
+			error(0, 0, "invalid file \"%s\", rebuilding the index", name);
+			text_index_close(idx);
+		}
+	}
+
+	just(close(fd));
+}
+
+void text_index_close(text_index* const idx)
+{
+	if(idx->mapped)
+		munmap(idx->base, idx->size);
+	else
+		mem_free(idx->base);
+
+	*idx = (text_index){0};
+}
+
+// growable array of 32-bit or 64-bit values
+typedef struct
+{
+	void* data;
+	size_t len, cap;
+} array;
+
+static
+void* array_push(array* const a, const size_t elem_size)
+{
+	if(a->len == a->cap)
+	{
+		a->cap = a->cap ? 2 * a->cap : 1024;
+		a->data = mem_realloc(a->data, a->cap * elem_size);
+	}
+
+	return (char*)a->data + elem_size * a->len++;
+}
+
+static
+int cmp_u64(const void* const a, const void* const b)
+{
+	const uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+
+	return (x > y) - (x < y);
+}
+
+// seen trigrams of the current page, one bit per trigram
+static uint64_t seen[(1 << 24) / 64];
+
+// add the distinct trigrams of the page text as (trigram, page) pairs; trigrams spanning
+// line breaks are skipped, as the queries are matched line by line
+static
+void add_page_grams(array* const pairs, const char* const name, const unsigned page)
+{
+	const int fd = open(name, O_RDONLY | O_CLOEXEC);
+
+	if(fd < 0)
+		die(errno, "cannot open file \"%s\"", name);
+
+	struct stat info;
+
+	just(fstat(fd, &info));
+
+	if(info.st_size >= 3)
+	{
+		const unsigned char* const text = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if(text == MAP_FAILED)
+			die(errno, "cannot map file \"%s\"", name);
+
+		const size_t first = pairs->len;
+
+		for(const unsigned char* p = text; p + 3 <= text + info.st_size; ++p)
+		{
+			if(p[0] == '\n' || p[1] == '\n' || p[2] == '\n')
+				continue;
+
+			const uint32_t g = trigram(p);
+
+			if(!(seen[g / 64] & ((uint64_t)1 << (g % 64))))
+			{
+				seen[g / 64] |= (uint64_t)1 << (g % 64);
+				*(uint64_t*)array_push(pairs, sizeof(uint64_t)) = ((uint64_t)g << 32) | page;
+			}
+		}
+
+		// clear the bits for the next page
+		for(size_t i = first; i < pairs->len; ++i)
+		{
+			const uint32_t g = ((const uint64_t*)pairs->data)[i] >> 32;
+
+			seen[g / 64] = 0;
+		}
+
+		munmap((void*)text, info.st_size);
+	}
+
+	just(close(fd));
+}
+
+static
+int cmp_pages(const void* const a, const void* const b)
+{
+	const uint32_t x = *(const uint32_t*)a, y = ((const struct index_page*)b)->page;
+
+	return (x > y) - (x < y);
+}
+
+static
+const struct index_page* find_page(const text_index* const idx, const uint32_t page)
+{
+	return bsearch(&page, idx->pages, idx->num_pages, sizeof(struct index_page), cmp_pages);
+}
+
+// write the index to a temporary file and rename it over the old one
+static
+void save(const text_index* const idx, const char* const dir, const char* const name)
+{
+	char* tmp;
+
+	just(asprintf(&tmp, "%s/" INDEX_FILE ".XXXXXX", dir));
+
+	const int fd = mkostemp(tmp, O_CLOEXEC);
+
+	if(fd < 0)
+	{
+		error(0, errno, "cannot create index file in \"%s\"", dir);
+		free(tmp);
+		return;
+	}
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	char* const data = mem_alloc(idx->size);
+
+	memcpy(data, idx->base, idx->size);
+	swap_index(data, idx->size, false);
+#else
+	const char* const data = idx->base;
+#endif
+
+	for(size_t n = 0; n < idx->size; )
+	{
+		const ssize_t ret = write(fd, data + n, idx->size - n);
+
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+				continue;
+
+			unlink(tmp);
+			die(errno, "error writing file \"%s\"", tmp);
+		}
+
+		n += ret;
+	}
+
+	if(fchmod(fd, 0644) != 0 || close(fd) != 0 || rename(tmp, name) != 0)
+	{
+		const int err = errno;
+
+		unlink(tmp);
+		die(err, "error writing file \"%s\"", name);
+	}
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	mem_free(data);
+#endif
+
+	free(tmp);
+}
+
+void text_index_update(text_index* const idx, const char* const dir, const str_list* const files)
+{
+	char* name;
+
+	just(asprintf(&name, "%s/" INDEX_FILE, dir));
+
+	text_index old;
+
+	load(&old, name);
+
+	// pages whose texts have not changed since the last update
+	static uint64_t keep[(MAX_PAGE_NO + 64) / 64];
+
+	memset(keep, 0, sizeof(keep));
+
+	const size_t num_files = str_list_len(files);
+	struct index_page* const pages = mem_alloc(max(num_files, (size_t)1) * sizeof(struct index_page));
+	array pairs = {0};
+	uint32_t num_pages = 0, num_kept = 0;
+
+	for(size_t i = 0; i < num_files; ++i)
+	{
+		const char* const file = str_ptr(files->strings[i]);
+		const unsigned page = page_no(files->strings[i], str_lit("txt"));
+		struct stat info;
+
+		if(num_pages > 0 && pages[num_pages - 1].page == page)
+			continue;	// the same page both in a shard and at the top level
+
+		if(stat(file, &info) != 0)
+			die(errno, "cannot stat file \"%s\"", file);
+
+		struct index_page* const p = &pages[num_pages++];
+
+		*p = (struct index_page){
+			.page = page,
+			.sec = info.st_mtim.tv_sec,
+			.nsec = info.st_mtim.tv_nsec,
+			.size = info.st_size
+		};
+
+		const struct index_page* const q = find_page(&old, page);
+
+		if(q && q->sec == p->sec && q->nsec == p->nsec && q->size == p->size)
+		{
+			keep[page / 64] |= (uint64_t)1 << (page % 64);
+			++num_kept;
+		}
+		else
+			add_page_grams(&pairs, file, page);
+	}
+
+	if(num_kept == num_pages && num_kept == old.num_pages)
+	{
+		// nothing has changed
+		*idx = old;
+		free(name);
+		mem_free(pages);
+		mem_free(pairs.data);
+		return;
+	}
+
+	// merge the postings of the unchanged pages with the trigrams of the new ones
+	qsort(pairs.data, pairs.len, sizeof(uint64_t), cmp_u64);
+
+	const uint64_t* const np = pairs.data;
+	array grams = {0}, postings = {0};
+	size_t i = 0, k = 0;
+
+	while(i < old.num_grams || k < pairs.len)
+	{
+		const uint32_t g = (i < old.num_grams && (k == pairs.len || old.grams[i].gram <= (np[k] >> 32)))
+						 ? old.grams[i].gram
+						 : (uint32_t)(np[k] >> 32);
+
+		const uint32_t *op = NULL, *op_end = NULL;
+
+		if(i < old.num_grams && old.grams[i].gram == g)
+		{
+			op = old.postings + old.grams[i].start;
+			op_end = op + old.grams[i].count;
+			++i;
+		}
+
+		const uint64_t start = postings.len;
+
+		for(;;)
+		{
+			// skip the changed and removed pages
+			while(op < op_end && !(keep[*op / 64] & ((uint64_t)1 << (*op % 64))))
+				++op;
+
+			const bool has_old = op < op_end, has_new = k < pairs.len && (np[k] >> 32) == g;
+
+			if(!has_old && !has_new)
+				break;
+
+			if(has_old && (!has_new || *op < (uint32_t)np[k]))
+				*(uint32_t*)array_push(&postings, sizeof(uint32_t)) = *op++;
+			else
+				*(uint32_t*)array_push(&postings, sizeof(uint32_t)) = (uint32_t)np[k++];
+		}
+
+		if(postings.len > start)
+			*(struct index_gram*)array_push(&grams, sizeof(struct index_gram))
+				= (struct index_gram){ g, postings.len - start, start };
+	}
+
+	mem_free(pairs.data);
+
+	// assemble the new index
+	const size_t size = sizeof(index_header)
+					  + num_pages * sizeof(struct index_page)
+					  + grams.len * sizeof(struct index_gram)
+					  + postings.len * sizeof(uint32_t);
+
+	char* const buff = mem_alloc(size);
+	index_header* const h = (index_header*)buff;
+
+	memcpy(h->signature, INDEX_SIGNATURE, sizeof(h->signature));
+	h->num_pages = num_pages;
+	h->num_grams = grams.len;
+	h->num_postings = postings.len;
+
+	char* p = buff + sizeof(index_header);
+
+	p = mempcpy(p, pages, num_pages * sizeof(struct index_page));
+	p = mempcpy(p, grams.data, grams.len * sizeof(struct index_gram));
+	memcpy(p, postings.data, postings.len * sizeof(uint32_t));
+
+	mem_free(pages);
+	mem_free(grams.data);
+	mem_free(postings.data);
+	text_index_close(&old);
+
+	*idx = (text_index){ .base = buff, .size = size };
+
+	if(!attach(idx))
+		die(0, "internal error: invalid index");
+
+	save(idx, dir, name);
+	free(name);
+}
+
+static
+int cmp_grams(const void* const a, const void* const b)
+{
+	const uint32_t x = *(const uint32_t*)a, y = ((const struct index_gram*)b)->gram;
+
+	return (x > y) - (x < y);
+}
+
+uint32_t* text_index_find(const text_index* const idx, const str pattern, size_t* const len)
+{
+	const unsigned char* const s = (const unsigned char*)str_ptr(pattern);
+	const size_t n = str_len(pattern);
+
+	*len = 0;
+
+	if(idx->num_pages == 0)
+		return NULL;
+
+	uint32_t* res;
+
+	// too short for a trigram: any page can match
+	if(n < 3)
+	{
+		res = mem_alloc(idx->num_pages * sizeof(uint32_t));
+
+		for(uint32_t i = 0; i < idx->num_pages; ++i)
+			res[i] = idx->pages[i].page;
+
+		*len = idx->num_pages;
+		return res;
+	}
+
+	// trigrams of the pattern, the rarest first
+	const struct index_gram** const list = mem_alloc((n - 2) * sizeof(struct index_gram*));
+
+	for(size_t i = 0; i + 3 <= n; ++i)
+	{
+		const uint32_t g = trigram(s + i);
+
+		if(!(list[i] = bsearch(&g, idx->grams, idx->num_grams, sizeof(struct index_gram), cmp_grams)))
+		{
+			mem_free(list);
+			return NULL;
+		}
+	}
+
+	const struct index_gram* rarest = list[0];
+
+	for(size_t i = 1; i + 3 <= n; ++i)
+		if(list[i]->count < rarest->count)
+			rarest = list[i];
+
+	// intersect the postings
+	res = mem_alloc(rarest->count * sizeof(uint32_t));
+	memcpy(res, idx->postings + rarest->start, rarest->count * sizeof(uint32_t));
+
+	size_t num = rarest->count;
+
+	for(size_t i = 0; i + 3 <= n && num > 0; ++i)
+	{
+		if(list[i] == rarest)
+			continue;
+
+		const uint32_t* p = idx->postings + list[i]->start;
+		const uint32_t* const end = p + list[i]->count;
+		size_t m = 0;
+
+		for(size_t j = 0; j < num; ++j)
+		{
+			while(p < end && *p < res[j])
+				++p;
+
+			if(p < end && *p == res[j])
+				res[m++] = res[j];
+		}
+
+		num = m;
+	}
+
+	mem_free(list);
+
+	if(num == 0)
+	{
+		mem_free(res);
+		return NULL;
+	}
+
+	*len = num;
+	return res;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "utils.h"
+
+#include <stdint.h>
+
+// trigram index of the page texts, kept in the project directory; the index records the
+// modification time and size of every page text, so that only the pages rewritten since
+// the last update are read again
+typedef struct
+{
+	void* base;				// file mapping or memory buffer
+	size_t size;
+	bool mapped;
+
+	uint32_t num_pages, num_grams;
+	uint64_t num_postings;
+
+	const struct index_page* pages;		// sorted by page number
+	const struct index_gram* grams;		// sorted by trigram
+	const uint32_t* postings;			// page numbers, sorted within each trigram
+} text_index;
+
+// load the index from the given directory and bring it up to date with the given page
+// files (as returned by list_files(), sorted by page number)
+void text_index_update(text_index* const idx, const char* const dir, const str_list* const files);
+
+// release the index
+void text_index_close(text_index* const idx);
+
+// pages that may contain the given pattern, in ascending order; the pattern must not
+// contain line breaks; returns NULL if no page can contain it
+uint32_t* text_index_find(const text_index* const idx, const str pattern, size_t* const len);
+
+// fold ASCII letters to lower case, as the index does
+static inline
+unsigned char fold_case(const unsigned char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
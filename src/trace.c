@@ -0,0 +1,103 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <inttypes.h>
+
+// trace file, shared by all the processes of the run
+static int trace_fd = -1;
+static char* trace_name = NULL;
+static pid_t trace_owner = 0;
+
+// append one event; the file is opened with O_APPEND, so the events written by
+// different processes are never interleaved
+static
+void trace_write(const char* const fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static
+void trace_write(const char* const fmt, ...)
+{
+	char buff[512];
+	va_list args;
+
+	va_start(args, fmt);
+
+	const int n = vsnprintf(buff, sizeof(buff), fmt, args);
+
+	va_end(args);
+
+	if(n < 0 || n >= (int)sizeof(buff))
+		die(0, "internal error (trace event too long)");
+
+	if(write(trace_fd, buff, n) != n)
+		die(errno, "error writing file \"%s\"", trace_name);
+}
+
+// complete the array of events; a trace cut short by an error is still readable,
+// as the viewers accept the array without the closing bracket
+static
+void trace_close(void)
+{
+	if(trace_fd < 0 || getpid() != trace_owner)
+		return;
+
+	trace_write("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"" PROG_NAME "\"}}\n]\n",
+				(int)trace_owner);
+
+	just(close(trace_fd));
+	trace_fd = -1;
+}
+
+void trace_open(const char* const fname, const unsigned num_workers)
+{
+	if((trace_fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644)) < 0)
+		die(errno, "cannot create file \"%s\"", fname);
+
+	trace_name = strdup(fname);
+	trace_owner = getpid();
+
+	trace_write("[\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"main\"}},\n",
+				(int)trace_owner);
+
+	for(unsigned i = 1; i <= num_workers; ++i)
+		trace_write("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"worker %u\"}},\n",
+					(int)trace_owner, i, i);
+
+	atexit(trace_close);
+}
+
+uint64_t trace_time(void)
+{
+	if(trace_fd < 0)
+		return 0;
+
+	struct timespec ts;
+
+	just(clock_gettime(CLOCK_MONOTONIC, &ts));
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void trace_span(const char* const name, const unsigned lane, const unsigned page, const uint64_t start)
+{
+	if(trace_fd < 0)
+		return;
+
+	trace_write("{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%" PRIu64 ",\"dur\":%" PRIu64
+				",\"args\":{\"page\":%u}},\n",
+				name, (int)trace_owner, lane, start, trace_time() - start, page);
+}
+
+void trace_span_range(const char* const name, const unsigned lane,
+					  const unsigned first, const unsigned last, const uint64_t start)
+{
+	if(trace_fd < 0)
+		return;
+
+	trace_write("{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%" PRIu64 ",\"dur\":%" PRIu64
+				",\"args\":{\"first_page\":%u,\"last_page\":%u}},\n",
+				name, (int)trace_owner, lane, start, trace_time() - start, first, last);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "utils.h"
+
+#include <stdint.h>
+
+// timeline of a run in the Chrome trace-event format, for chrome://tracing or Perfetto;
+// the main process and all its children append events to the same file, one lane per
+// worker (lane 0 is the main process, lane N is worker N - 1). All the functions do
+// nothing until the trace is opened.
+void trace_open(const char* const fname, const unsigned num_workers);
+
+// current time, in microseconds
+uint64_t trace_time(void);
+
+// record a span on the given lane, from the given start time till now, tagged with
+// the page number
+void trace_span(const char* const name, const unsigned lane, const unsigned page, const uint64_t start);
+
+// same, for a range of pages
+void trace_span_range(const char* const name, const unsigned lane,
+					  const unsigned first, const unsigned last, const uint64_t start);
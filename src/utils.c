@@ -3,6 +3,7 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
@@ -22,6 +23,27 @@ void check_exit_status(int status)
 	}
 }
 
+void append_line(const int fd, const char* const name, const char* const line, const size_t len)
+{
+	struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+
+	// a file system without locks can still take the write as is
+	while(fcntl(fd, F_SETLKW, &lock) != 0)
+	{
+		if(errno == ENOLCK)
+			break;
+
+		if(errno != EINTR)
+			die(errno, "cannot lock file \"%s\"", name);
+	}
+
+	if(write(fd, line, len) != (ssize_t)len)
+		die(errno, "error writing file \"%s\"", name);
+
+	lock.l_type = F_UNLCK;
+	fcntl(fd, F_SETLK, &lock);
+}
+
 // program version display
 #ifndef PROG_NAME
 #error constant PROG_NAME is undefined
@@ -27,6 +27,10 @@ void* _check_ptr_ret(void* const ret, const char* const file, const int line);
 // exit status check
 void check_exit_status(int status);
 
+// append the line to the file opened with O_APPEND, under a write lock on the file, as
+// O_APPEND alone does not keep the writes of several hosts apart on NFS
+void append_line(const int fd, const char* const name, const char* const line, const size_t len);
+
 // unused parameter
 #define UNUSED(x) UNUSED_ ## x __attribute__((unused))
 